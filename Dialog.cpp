@@ -39,7 +39,7 @@ std::string Greeter::password()const{
 	return pass->text().toStdString();
 }
 
-NewMaster::NewMaster(const std::string &current){
+NewMaster::NewMaster(bool change){
 	setWindowTitle("Create a new Master Password");
 	resize(300, 0);
 
@@ -59,20 +59,17 @@ NewMaster::NewMaster(const std::string &current){
 	auto help = new QLabel(helptext);
 	help->setWordWrap(true);
 	help->setMaximumWidth(400);
-	auto currentpass = new QLineEdit;
+	QLineEdit *const currentpass = change ? new QLineEdit : NULL;
 	auto ok = new QPushButton("OK");
 	auto cancel = new QPushButton("Cancel");
 	first = new QLineEdit;
 	second = new QLineEdit;
 	first->setEchoMode(QLineEdit::Password);
 	second->setEchoMode(QLineEdit::Password);
-	QObject::connect(ok, &QPushButton::clicked, [this, &current, currentpass](){
+	QObject::connect(ok, &QPushButton::clicked, [this, currentpass](){
 		if(first->text() != second->text()){
 			QMessageBox::critical(this, "Error", "Passwords do not match!");
 		}
-		else if(current.size() > 0 && current != currentpass->text().toStdString()){
-			QMessageBox::critical(this, "Error", "Incorrect current master password!");
-		}
 		else{
 			if(first->text().length() == 0){
 				if(QMessageBox::No == QMessageBox::warning(this, "Empty Password", "Having an empty password can be very dangerous, "
@@ -82,17 +79,17 @@ NewMaster::NewMaster(const std::string &current){
 				}
 			}
 			master = first->text().toStdString();
+			if(currentpass != NULL)
+				old = currentpass->text().toStdString();
 			accept();
 		}
 	});
 	QObject::connect(cancel, &QPushButton::clicked, this, &QDialog::reject);
 
-	if(current.size() > 0){
+	if(currentpass != NULL){
 		currentpass->setEchoMode(QLineEdit::Password);
 		form->addRow("Current Master Password", currentpass);
 	}
-	else
-		delete currentpass;
 
 	form->addRow("Master Password", first);
 	form->addRow("Confirm Password", second);
@@ -109,6 +106,10 @@ std::string NewMaster::password()const{
 	return master;
 }
 
+std::string NewMaster::current()const{
+	return old;
+}
+
 AddPassword::AddPassword(Manager &manager, const std::string *nm, const std::string *un, const std::string *pw){
 	const char *const nametip = "The service that the password is associated with (e.g. Facebook)";
 	const char *const usrtip = "The user name";
@@ -195,12 +196,17 @@ Password AddPassword::password()const{
 	return pw;
 }
 
-ViewPassword::ViewPassword(const Password &passwd, Passwords &parent, Manager &manager){
+ViewPassword::ViewPassword(const Password &passwd, Passwords &parent, Manager &manager)
+	:name(passwd.name())
+{
 	const char *const copyto = "Copy to clipboard";
 	const char *const copied = "Copied";
 
+	// first, decrypting it can throw Manager::Corrupt and nothing's been made yet
+	const std::string password = passwd.password();
+
 	resize(350, 0);
-	setWindowTitle(passwd.name().c_str());
+	setWindowTitle(name.c_str());
 
 	auto vbox = new QVBoxLayout;
 	auto hboxusername = new QHBoxLayout;
@@ -208,12 +214,12 @@ ViewPassword::ViewPassword(const Password &passwd, Passwords &parent, Manager &m
 	auto editdelete = new QHBoxLayout;
 	setLayout(vbox);
 
-	auto namelabel = new QLabel(("Description: " + passwd.name()).c_str());
+	auto namelabel = new QLabel(("Description: " + name).c_str());
 	auto usrnamelabel = new QLabel("User name:");
 	auto passlabel = new QLabel("Password:");
-	auto usrnamefield = new QLineEdit(passwd.username().c_str());
+	auto usrnamefield = new QLineEdit(std::string(passwd.username()).c_str());
 	usrnamefield->setReadOnly(true);
-	auto passfield = new QLineEdit(passwd.password().c_str());
+	auto passfield = new QLineEdit(password.c_str());
 	passfield->setReadOnly(true);
 	auto copytoclipboard = new QPushButton(copyto);
 	copytoclipboard->setToolTip("Copy the password to the clipboard");
@@ -230,30 +236,35 @@ ViewPassword::ViewPassword(const Password &passwd, Passwords &parent, Manager &m
 		});
 	});
 
-	QObject::connect(edit, &QPushButton::clicked, [this, &passwd, &manager, &parent, namelabel, usrnamefield, passfield]{
+	QObject::connect(edit, &QPushButton::clicked, [this, &manager, &parent, namelabel, usrnamefield, passfield]{
 		try{
-			const std::string name = passwd.name();
-			const std::string username = passwd.username();
+			const Password &passwd = manager.find(name);
+			const std::string username(passwd.username());
 			const std::string pass = passwd.password();
 			AddPassword editpass(manager, &name, &username, &pass);
 			if(editpass.exec()){
 				const Password &pass = editpass.password();
-				manager.edit(name, pass.name(), pass.username(), pass.password());
-				namelabel->setText(("Description: " + pass.name()).c_str());
-				usrnamefield->setText(pass.username().c_str());
+				const std::string newname(pass.name());
+				const std::string newusername(pass.username());
+				manager.edit(name, newname, newusername, pass.password());
+				name = newname;
+				namelabel->setText(("Description: " + name).c_str());
+				usrnamefield->setText(newusername.c_str());
 				passfield->setText(pass.password().c_str());
-				this->setWindowTitle(pass.name().c_str());
+				this->setWindowTitle(name.c_str());
 				parent.refresh();
 			}
 		}catch(const Manager::ManagerException &e){
 			QMessageBox::critical(this, "Database Error", e.what());
+		}catch(const Manager::Corrupt&){
+			QMessageBox::critical(this, "Database Error", "The password could not be decrypted, the database appears to be corrupt.");
 		}
 	});
 
-	QObject::connect(remove, &QPushButton::clicked, [this, &parent, &manager, &passwd]{
+	QObject::connect(remove, &QPushButton::clicked, [this, &parent, &manager]{
 		if(QMessageBox::question(this, "Remove Item?", "Are you sure you want to remove this item?", QMessageBox::Yes | QMessageBox::No, QMessageBox::No) == QMessageBox::Yes){
 			try{
-				manager.remove(passwd.name());
+				manager.remove(name);
 				parent.refresh();
 			}catch(const Manager::ManagerException &e){
 				QMessageBox::critical(this, "Database Error", e.what());
@@ -277,7 +288,7 @@ ViewPassword::ViewPassword(const Password &passwd, Passwords &parent, Manager &m
 	vbox->addLayout(editdelete);
 }
 
-Settings::Settings(const Settings::config &c){
+Settings::Settings(){
 	resize(300, 0);
 	setWindowTitle("Settings");
 
@@ -286,9 +297,10 @@ Settings::Settings(const Settings::config &c){
 
 	auto chmaster = new QPushButton("Change Master Password");
 
-	QObject::connect(chmaster, &QPushButton::clicked, [this, &c, chmaster]{
-		NewMaster newm(c.master);
+	QObject::connect(chmaster, &QPushButton::clicked, [this]{
+		NewMaster newm(true);
 		if(newm.exec()){
+			cfg.current = newm.current();
 			cfg.master = newm.password();
 			accept();
 		}
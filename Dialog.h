@@ -16,15 +16,17 @@ private:
 	QLineEdit *pass;
 };
 
-// generate new master password
+// generate new master password, asking for the current one too when it's a change
 class NewMaster:public QDialog{
 public:
-	NewMaster(const std::string& = "");
+	NewMaster(bool = false);
 	std::string password()const;
+	std::string current()const;
 private:
 	QLineEdit *first;
 	QLineEdit *second;
 	std::string master;
+	std::string old;
 };
 
 class AddPassword:public QDialog{
@@ -40,15 +42,18 @@ private:
 class ViewPassword:public QDialog{
 public:
 	ViewPassword(const Password&, Passwords&, Manager&);
+private:
+	std::string name; // entries can move around as the manager changes, so look it up by name each time
 };
 
 class Settings:public QDialog{
 public:
 	struct config{
+		std::string current; // the master password the user typed in to change it, the manager checks it
 		std::string master;
 	};
 
-	Settings(const config&);
+	Settings();
 	config get_config()const;
 
 private:
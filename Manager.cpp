@@ -1,5 +1,14 @@
 #include <fstream>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <iterator>
+#include <exception>
+#include <stdexcept>
 #include <cctype>
+#include <array>
+#include <unordered_set>
+#include <tuple>
 
 #include <stdlib.h>
 #include <time.h>
@@ -8,6 +17,9 @@
 #include <QDir>
 #include <QDate>
 
+#include <zlib.h>
+#include <openssl/crypto.h>
+
 #ifdef _WIN32
 #include <windows.h>
 #else
@@ -18,8 +30,43 @@
 
 #include "Manager.h"
 #include "crypto.h"
+#include "agent.h"
 
 #define AMERICAN_ENGLISH_BYTES 102400
+#define READ_BLOCK_SIZE 65536
+#define SEGMENT_SIZE 65536 // plaintext bytes per independently encrypted segment
+#define JOURNAL_MAX_RECORDS 500 // compact the journal back into "db" after this many records
+#define JOURNAL_MAGIC "PWJN"
+#define UNLOCK_MILLISECONDS 500 // how long key derivation should take when the master password is set
+#define DB_MAGIC "PWDB"
+#define DB_VERSION 6
+#define DB_REVISION 0 // bumped instead of DB_VERSION when parts only gain fields after the ones this version knows, which it skips
+#define COMPRESSION_NONE 0
+#define COMPRESSION_ZLIB 1
+#define DB_COMPRESSION COMPRESSION_ZLIB // for new databases and ones upgraded from an older version
+#define COMPRESSION_LEVEL 1 // most of the size win for a fraction of the time of the default level
+#define RECORD_FIELDS 3 // name, user name, password; what Password::pack writes
+#define INDEX_FIELDS 2 // name, user name
+#define SECRETS_FIELDS 1 // password
+#define BACKUPS_DAILY 7 // the newest backups are all kept
+#define BACKUPS_WEEKLY 5 // after that, the newest one of each week
+#define BACKUPS_MONTHLY 12 // and the newest one of each month
+#define BACKUP_MAGIC "PWBK"
+#define BACKUP_VERSION 2 // version 1 has the records in database order, version 2 in name order
+#define CHUNK_MIN 2048 // backups are split into chunks of 2k to 64k, 8k on average
+#define CHUNK_AVERAGE 8192
+#define CHUNK_MAX 65536
+#define CHUNK_MASK_HARD 0xfffe000000000000ULL // 15 bits, boundaries below CHUNK_AVERAGE
+#define CHUNK_MASK_EASY 0xffe0000000000000ULL // 11 bits, boundaries above it
+
+// passwords-crashtest builds this with CRASHTEST defined and supplies crashpoint(), which kills the process when it's
+// told to at one of the steps of writing the database or the journal, see crashtest.cpp
+#ifdef CRASHTEST
+void crashpoint(const char*);
+#define CRASHPOINT(step) crashpoint(step)
+#else
+#define CRASHPOINT(step)
+#endif
 
 #ifdef _WIN32
 #include <windows.h>
@@ -32,21 +79,687 @@ static std::string get_resource_dir(){
 
 	return path;
 }
+static std::string get_db_dir(){
+	char path[MAX_PATH];
+	ExpandEnvironmentStrings("%USERPROFILE%\\Documents\\PasswordsDB", path, MAX_PATH - 1);
+
+	return path;
+}
+// flush a file's contents to the disk
+static bool syncfile(const std::string &name){
+	HANDLE file = CreateFile(name.c_str(), GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(file == INVALID_HANDLE_VALUE)
+		return false;
+
+	const bool success = FlushFileBuffers(file) != 0;
+	CloseHandle(file);
+	return success;
+}
+// windows has no way to flush a directory entry, MOVEFILE_WRITE_THROUGH covers it
+static bool syncdir(const std::string&){
+	return true;
+}
+static bool replacefile(const std::string &from, const std::string &to){
+	return MoveFileEx(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+}
+static bool linkfile(const std::string &from, const std::string &to){
+	return CreateHardLink(to.c_str(), from.c_str(), NULL) != 0;
+}
+static bool truncatefile(const std::string &name, long long length){
+	HANDLE file = CreateFile(name.c_str(), GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER li;
+	li.QuadPart = length;
+	const bool success = SetFilePointerEx(file, li, NULL, FILE_BEGIN) != 0 && SetEndOfFile(file) != 0;
+	CloseHandle(file);
+	return success;
+}
+// map a whole file read-only, NULL if it can't be
+static const unsigned char *mapfile(const std::string &name, long long){
+	HANDLE file = CreateFile(name.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if(file == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if(mapping == NULL)
+		return NULL;
+
+	// the view keeps the mapping alive
+	const void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	return (const unsigned char*)view;
+}
+static void unmapfile(const unsigned char *view, long long){
+	UnmapViewOfFile(view);
+}
 #else
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <wordexp.h>
 static void makefolder(const std::string &name){
 	mkdir(name.c_str(), S_IRUSR | S_IWUSR | S_IXUSR);
 }
 static std::string get_resource_dir(){
 	return "/usr/share/Passwords";
 }
+static std::string get_db_dir(){
+	wordexp_t p;
+
+	wordexp("~/.passwordsdb", &p, 0);
+	const std::string path = p.we_wordv[0];
+	wordfree(&p);
+
+	return path;
+}
+// flush a file's contents to the disk
+static bool syncfile(const std::string &name){
+	const int fd = open(name.c_str(), O_RDONLY);
+	if(fd == -1)
+		return false;
+
+	const bool success = fsync(fd) == 0;
+	close(fd);
+	return success;
+}
+// flush a directory's entries (i.e. a rename) to the disk
+static bool syncdir(const std::string &name){
+	return syncfile(name);
+}
+static bool replacefile(const std::string &from, const std::string &to){
+	return rename(from.c_str(), to.c_str()) == 0;
+}
+static bool linkfile(const std::string &from, const std::string &to){
+	return link(from.c_str(), to.c_str()) == 0;
+}
+static bool truncatefile(const std::string &name, long long length){
+	return truncate(name.c_str(), length) == 0;
+}
+// map a whole file read-only, NULL if it can't be
+// it's read front to back once, so ask for aggressive readahead and early eviction
+static const unsigned char *mapfile(const std::string &name, long long length){
+	const int fd = open(name.c_str(), O_RDONLY);
+	if(fd == -1)
+		return NULL;
+
+	void *view = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(view == MAP_FAILED)
+		return NULL;
+
+	madvise(view, length, MADV_SEQUENTIAL);
+	return (const unsigned char*)view;
+}
+static void unmapfile(const unsigned char *view, long long length){
+	munmap((void*)view, length);
+}
 #endif // _WIN32
 
+// <from> under the name <to> as well, a hard link where the file system has them and a copy where it doesn't
+// saves never write to a file in place, so the link keeps <from>'s contents even after it's replaced
+static bool keepfile(const std::string &from, const std::string &to){
+	if(linkfile(from, to))
+		return true;
+
+	std::ifstream in(from, std::ifstream::binary);
+	std::ofstream out(to, std::ofstream::binary);
+	out << in.rdbuf();
+	out.close();
+	return in && out && syncfile(to);
+}
+
+// unmaps on the way out of the reader, whether it finished or not
+struct Mapping{
+	Mapping(const unsigned char *d, long long l)
+		:data(d)
+		,length(l)
+	{}
+	Mapping(const Mapping&) = delete;
+	~Mapping(){
+		if(data != NULL)
+			unmapfile(data, length);
+	}
+
+	const unsigned char *const data;
+	const long long length;
+};
+
+// zlib, one part of the database at a time
+// the state is set up once and reset between parts, setting it up costs more than compressing a small part
+class Deflater{
+public:
+	Deflater(){
+		memset(&stream, 0, sizeof(stream));
+		if(deflateInit(&stream, COMPRESSION_LEVEL) != Z_OK)
+			throw Manager::ManagerException("could not initialize zlib");
+	}
+	Deflater(const Deflater&) = delete;
+	~Deflater(){
+		deflateEnd(&stream);
+	}
+
+	void run(std::string_view in, std::vector<unsigned char> &out){
+		out.resize(deflateBound(&stream, in.length()));
+		stream.next_in = (Bytef*)in.data();
+		stream.avail_in = in.length();
+		stream.next_out = out.data();
+		stream.avail_out = out.size();
+		const int ret = deflate(&stream, Z_FINISH);
+		out.resize(out.size() - stream.avail_out);
+		deflateReset(&stream);
+		if(ret != Z_STREAM_END)
+			throw Manager::ManagerException("could not compress the database");
+	}
+
+private:
+	z_stream stream;
+};
+
+// the inflated size isn't stored, so the output grows a block at a time until the stream ends
+static void inflate_part(const std::vector<unsigned char> &in, std::vector<unsigned char> &out){
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if(inflateInit(&stream) != Z_OK)
+		throw Manager::ManagerException("could not initialize zlib");
+
+	stream.next_in = (Bytef*)in.data();
+	stream.avail_in = in.size();
+	out.clear();
+	out.reserve(in.size() * 4);
+
+	int ret;
+	do{
+		const std::vector<unsigned char>::size_type have = out.size();
+		out.resize(have + READ_BLOCK_SIZE);
+		stream.next_out = out.data() + have;
+		stream.avail_out = READ_BLOCK_SIZE;
+		ret = inflate(&stream, Z_NO_FLUSH);
+		out.resize(out.size() - stream.avail_out);
+	}while(ret == Z_OK);
+
+	inflateEnd(&stream);
+	if(ret != Z_STREAM_END || stream.avail_in != 0)
+		throw Manager::Corrupt();
+}
+
+// backups are named for the day they were made, YYYY_MM_DD.backup, and any more made that day YYYY_MM_DD.N.backup
+static std::string backup_name(const QDate &date, unsigned sequence = 0){
+	std::string name = std::to_string(date.year()) + "_" + std::to_string(date.month()) + "_" + std::to_string(date.day());
+	if(sequence > 0)
+		name += "." + std::to_string(sequence);
+
+	return name + ".backup";
+}
+
+// backup chunks are stored under their mac in hex
+static std::string hex(const unsigned char *data, int length){
+	static const char digits[] = "0123456789abcdef";
+
+	std::string out;
+	out.reserve(length * 2);
+	for(int i = 0; i < length; ++i){
+		out.push_back(digits[data[i] >> 4]);
+		out.push_back(digits[data[i] & 15]);
+	}
+
+	return out;
+}
+
+// random values for the rolling hash that places chunk boundaries
+// they only have to stay the same from one backup to the next for chunks to be shared, so they come from a fixed seed (splitmix64)
+static const std::array<unsigned long long, 256> &gear(){
+	static const std::array<unsigned long long, 256> table = [](){
+		std::array<unsigned long long, 256> values;
+		unsigned long long state = 0;
+		for(unsigned long long &v : values){
+			state += 0x9e3779b97f4a7c15ULL;
+			unsigned long long z = state;
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+			v = z ^ (z >> 31);
+		}
+		return values;
+	}();
+
+	return table;
+}
+
+// length of the chunk at the front of <data>
+// boundaries go where a rolling hash of the last 64 bytes matches a pattern, so an edit only changes the chunks around it
+// instead of moving every boundary after it. the pattern is harder to match below CHUNK_AVERAGE and easier above it,
+// which keeps most chunks close to the average (fastcdc)
+static std::string_view::size_type chunk(std::string_view data){
+	if(data.length() <= CHUNK_MIN)
+		return data.length();
+
+	const std::array<unsigned long long, 256> &table = gear();
+	const std::string_view::size_type average = std::min<std::string_view::size_type>(data.length(), CHUNK_AVERAGE);
+	const std::string_view::size_type end = std::min<std::string_view::size_type>(data.length(), CHUNK_MAX);
+
+	unsigned long long hash = 0;
+	std::string_view::size_type i = CHUNK_MIN;
+	for(; i < average; ++i){
+		hash = (hash << 1) + table[(unsigned char)data[i]];
+		if((hash & CHUNK_MASK_HARD) == 0)
+			return i + 1;
+	}
+	for(; i < end; ++i){
+		hash = (hash << 1) + table[(unsigned char)data[i]];
+		if((hash & CHUNK_MASK_EASY) == 0)
+			return i + 1;
+	}
+
+	return end;
+}
+
+// a backup: which chunks, in what order, make up the packed records of the database on that day
+// [magic][version][kdf iterations][kdf salt][records length][chunk count][chunk macs...][mac of everything before it]
+// the chunks are named by macs, which give nothing away, so they're stored in the clear and unused chunks can be found without a key
+struct Manifest{
+	unsigned version;
+	crypto::kdf params;
+	unsigned long long length;
+	std::vector<std::string> chunks; // in hex, the chunk's file name
+	std::string body; // what <mac> covers
+	unsigned char mac[crypto::MAC_SIZE];
+};
+
+// false if <file> isn't a manifest, i.e. it's a full copy of the database from before backups were chunked
+static bool load_manifest(const std::string &file, Manifest &manifest){
+	std::ifstream in(file, std::ifstream::binary);
+	if(!in)
+		throw Manager::NotFound();
+
+	char magic[4];
+	in.read(magic, sizeof(magic));
+	if(!in || memcmp(magic, BACKUP_MAGIC, sizeof(magic)) != 0)
+		return false;
+
+	manifest.body.assign(magic, sizeof(magic));
+	manifest.body.append(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+	unsigned long long count;
+	const unsigned long long fixed = sizeof(magic) + sizeof(manifest.version) + sizeof(manifest.params.iterations) + sizeof(manifest.params.salt) + sizeof(manifest.length) + sizeof(count);
+	if(manifest.body.length() < fixed + crypto::MAC_SIZE)
+		throw Manager::Corrupt();
+
+	const char *pos = manifest.body.data() + sizeof(magic);
+	memcpy(&manifest.version, pos, sizeof(manifest.version));
+	pos += sizeof(manifest.version);
+	memcpy(&manifest.params.iterations, pos, sizeof(manifest.params.iterations));
+	pos += sizeof(manifest.params.iterations);
+	memcpy(manifest.params.salt, pos, sizeof(manifest.params.salt));
+	pos += sizeof(manifest.params.salt);
+	memcpy(&manifest.length, pos, sizeof(manifest.length));
+	pos += sizeof(manifest.length);
+	memcpy(&count, pos, sizeof(count));
+	pos += sizeof(count);
+
+	const unsigned long long macs = manifest.body.length() - fixed - crypto::MAC_SIZE;
+	if(manifest.version == 0 || manifest.version > BACKUP_VERSION || manifest.params.iterations == 0 || macs % crypto::MAC_SIZE != 0 || count != macs / crypto::MAC_SIZE)
+		throw Manager::Corrupt();
+
+	manifest.chunks.clear();
+	manifest.chunks.reserve(count);
+	for(unsigned long long i = 0; i < count; ++i, pos += crypto::MAC_SIZE)
+		manifest.chunks.push_back(hex((const unsigned char*)pos, crypto::MAC_SIZE));
+
+	memcpy(manifest.mac, pos, sizeof(manifest.mac));
+	manifest.body.resize(manifest.body.length() - crypto::MAC_SIZE);
+	return true;
+}
+
+// the passwords of sealed entries, each segment decrypted once: it's opened for the first of its entries that's asked for
+// and dropped after the last one, so going through entries in the order they were read only ever holds one segment.
+// every entry given to the constructor has to be asked for exactly once
+class Manager::Unsealer{
+public:
+	Unsealer(const std::vector<Password>&);
+	std::string password(const Password&);
+
+private:
+	struct Segment{
+		unsigned remaining; // entries still to be asked for
+		std::vector<std::string> passwords; // empty until it's opened
+	};
+
+	std::unordered_map<const Sealed*, Segment> segments;
+};
+
+Manager::Unsealer::Unsealer(const std::vector<Password> &entries){
+	for(const Password &pw : entries){
+		if(pw.sealed)
+			++segments[pw.sealed.get()].remaining;
+	}
+}
+
+std::string Manager::Unsealer::password(const Password &pw){
+	if(!pw.sealed)
+		return pw.password();
+
+	const auto it = segments.find(pw.sealed.get());
+	if(it == segments.end())
+		throw Corrupt();
+
+	Segment &segment = it->second;
+	if(segment.passwords.empty()){
+		try{
+			segment.passwords = pw.sealed->open();
+		}catch(const crypto::exception&){
+			throw Corrupt();
+		}
+	}
+
+	if(pw.slot >= segment.passwords.size())
+		throw Corrupt();
+
+	const std::string password = segment.passwords[pw.slot];
+	if(--segment.remaining == 0)
+		segments.erase(it);
+	return password;
+}
+
+// the entries of one backup, or of the open database, one at a time in name order
+// chunked backups from version 2 on are already in name order, so they're decrypted a chunk at a time as they're read and
+// only the current chunk is held in memory. anything else is loaded up front and sorted
+class Manager::Reader{
+public:
+	Reader(const std::string&, const std::string&, const std::string&);
+	Reader(const Manager&);
+	Reader(const Reader&) = delete;
+	bool next(Password&);
+
+private:
+	void fill();
+	void sort();
+
+	const std::string dir;
+	Manifest manifest;
+	crypto::secret key;
+	bool streaming;
+	std::vector<std::string>::size_type chunk; // the next one to decrypt
+	unsigned long long fields; // per record, 0 until it's been read
+	unsigned long long total; // bytes decrypted so far
+	std::string buffer; // the end of the last chunk and the start of this one
+	std::string::size_type consumed;
+	std::vector<unsigned char> ciphertext;
+	std::vector<unsigned char> raw;
+	std::vector<unsigned char> plaintext;
+
+	// when not streaming
+	std::vector<Password> entries;
+	std::shared_ptr<const std::vector<Password>> live; // the open database's entries instead of <entries>
+	std::unique_ptr<Unsealer> unsealer; // for <live>
+	std::vector<std::vector<Password>::size_type> order;
+	std::vector<Password>::size_type at;
+};
+
+// positions in <entries>, sorted by name
+// sorted on the first 8 folded bytes of the name, packed so they compare as one integer,
+// and only following the pointer to the whole name when those tie
+static std::vector<std::vector<Password>::size_type> by_name(const std::vector<Password> &entries){
+	std::vector<std::pair<std::uint64_t, std::vector<Password>::size_type>> keyed(entries.size());
+	for(std::vector<Password>::size_type i = 0; i < entries.size(); ++i){
+		const std::string_view name = entries[i].name();
+		std::uint64_t prefix = 0;
+		for(int j = 0; j < 8; ++j)
+			prefix = prefix << 8 | (j < (int)name.length() ? tolower((unsigned char)name[j]) : 0);
+
+		keyed[i] = std::make_pair(prefix, i);
+	}
+
+	std::sort(keyed.begin(), keyed.end(), [&entries](const std::pair<std::uint64_t, std::vector<Password>::size_type> &a, const std::pair<std::uint64_t, std::vector<Password>::size_type> &b){
+		if(a.first != b.first)
+			return a.first < b.first;
+		return entries[a.second] < entries[b.second];
+	});
+
+	std::vector<std::vector<Password>::size_type> order(keyed.size());
+	for(std::vector<Password>::size_type i = 0; i < keyed.size(); ++i)
+		order[i] = keyed[i].second;
+	return order;
+}
+
+static const std::uint32_t NO_NODE = 0xffffffff;
+
+// the positions of the entries in name order, as a treap where the node of every entry sits at the same position the entry
+// does, and knows how many nodes are under it. so the n-th name is found, and a name put in or taken out, in O(log N) steps
+// instead of shifting a vector of every position. the entries themselves are passed in, the copy-on-write may have replaced them
+class Manager::Order{
+public:
+	Order();
+	void build(const std::vector<std::vector<Password>::size_type>&);
+	std::vector<Password>::size_type at(std::vector<Password>::size_type)const;
+	std::vector<std::vector<Password>::size_type> list()const;
+	void insert(std::vector<Password>::size_type, const std::vector<Password>&);
+	void erase(std::vector<Password>::size_type, const std::vector<Password>&);
+	void move(std::vector<Password>::size_type, std::vector<Password>::size_type, const std::vector<Password>&);
+
+private:
+	struct Node{
+		std::uint32_t left;
+		std::uint32_t right;
+		std::uint32_t count; // nodes in the subtree
+		std::uint32_t priority; // random, and higher than the children's
+	};
+
+	std::uint32_t count(std::uint32_t)const;
+	void update(std::uint32_t);
+	std::uint32_t merge(std::uint32_t, std::uint32_t);
+	void split(std::uint32_t, const Password&, const std::vector<Password>&, std::uint32_t&, std::uint32_t&);
+	std::uint32_t remove(std::uint32_t, std::uint32_t, const std::vector<Password>&);
+	std::uint32_t random();
+
+	std::vector<Node> nodes; // by position in the entries
+	std::uint32_t root;
+	std::uint32_t seed; // xorshift state for the priorities
+};
+
+Manager::Order::Order()
+	:root(NO_NODE)
+	,seed(2463534242u)
+{}
+
+// from positions already in name order, in one pass: every node goes on the right edge of the tree, under the last node
+// there with a higher priority, and takes the ones it passes as its left subtree. a node that's passed over is done
+void Manager::Order::build(const std::vector<std::vector<Password>::size_type> &sorted){
+	nodes.assign(sorted.size(), Node());
+	root = NO_NODE;
+
+	std::vector<std::uint32_t> edge;
+	for(const std::vector<Password>::size_type position : sorted){
+		Node &node = nodes[position];
+		node.left = NO_NODE;
+		node.right = NO_NODE;
+		node.priority = random();
+
+		while(!edge.empty() && nodes[edge.back()].priority < node.priority){
+			node.left = edge.back();
+			update(edge.back());
+			edge.pop_back();
+		}
+		if(!edge.empty())
+			nodes[edge.back()].right = position;
+		edge.push_back(position);
+	}
+
+	while(!edge.empty()){
+		update(edge.back());
+		root = edge.back();
+		edge.pop_back();
+	}
+}
+
+// position of the entry with the <rank>th name
+std::vector<Password>::size_type Manager::Order::at(std::vector<Password>::size_type rank)const{
+	if(rank >= count(root))
+		throw std::out_of_range("no entry " + std::to_string(rank) + " in name order");
+
+	std::uint32_t node = root;
+	for(;;){
+		const std::uint32_t left = count(nodes[node].left);
+		if(rank < left)
+			node = nodes[node].left;
+		else if(rank == left)
+			return node;
+		else{
+			rank -= left + 1;
+			node = nodes[node].right;
+		}
+	}
+}
+
+// every position, in name order
+std::vector<std::vector<Password>::size_type> Manager::Order::list()const{
+	std::vector<std::vector<Password>::size_type> sorted;
+	sorted.reserve(count(root));
+
+	std::vector<std::uint32_t> path;
+	std::uint32_t node = root;
+	while(node != NO_NODE || !path.empty()){
+		while(node != NO_NODE){
+			path.push_back(node);
+			node = nodes[node].left;
+		}
+
+		node = path.back();
+		path.pop_back();
+		sorted.push_back(node);
+		node = nodes[node].right;
+	}
+
+	return sorted;
+}
+
+// the entry at <position> is new or was renamed
+void Manager::Order::insert(std::vector<Password>::size_type position, const std::vector<Password> &entries){
+	if(position >= nodes.size())
+		nodes.resize(position + 1);
+
+	Node &node = nodes[position];
+	node.left = NO_NODE;
+	node.right = NO_NODE;
+	node.count = 1;
+	node.priority = random();
+
+	std::uint32_t before;
+	std::uint32_t after;
+	split(root, entries[position], entries, before, after);
+	root = merge(merge(before, position), after);
+}
+
+// take out the entry at <position>, before it's removed or renamed
+void Manager::Order::erase(std::vector<Password>::size_type position, const std::vector<Password> &entries){
+	root = remove(root, position, entries);
+}
+
+// the entry at <from> is moving to <to>, which isn't in the order
+void Manager::Order::move(std::vector<Password>::size_type from, std::vector<Password>::size_type to, const std::vector<Password> &entries){
+	if(to >= nodes.size())
+		nodes.resize(to + 1);
+
+	std::uint32_t *link = &root;
+	while(*link != from)
+		link = entries[from] < entries[*link] ? &nodes[*link].left : &nodes[*link].right;
+
+	nodes[to] = nodes[from];
+	*link = to;
+}
+
+std::uint32_t Manager::Order::count(std::uint32_t node)const{
+	return node == NO_NODE ? 0 : nodes[node].count;
+}
+
+void Manager::Order::update(std::uint32_t node){
+	nodes[node].count = 1 + count(nodes[node].left) + count(nodes[node].right);
+}
+
+// every name under <left> comes before every name under <right>
+std::uint32_t Manager::Order::merge(std::uint32_t left, std::uint32_t right){
+	if(left == NO_NODE)
+		return right;
+	if(right == NO_NODE)
+		return left;
+
+	if(nodes[left].priority > nodes[right].priority){
+		nodes[left].right = merge(nodes[left].right, right);
+		update(left);
+		return left;
+	}
+
+	nodes[right].left = merge(left, nodes[right].left);
+	update(right);
+	return right;
+}
+
+// the names under <node> before <pw> go to <before>, the rest to <after>
+void Manager::Order::split(std::uint32_t node, const Password &pw, const std::vector<Password> &entries, std::uint32_t &before, std::uint32_t &after){
+	if(node == NO_NODE){
+		before = NO_NODE;
+		after = NO_NODE;
+		return;
+	}
+
+	if(entries[node] < pw){
+		split(nodes[node].right, pw, entries, nodes[node].right, after);
+		before = node;
+	}
+	else{
+		split(nodes[node].left, pw, entries, before, nodes[node].left);
+		after = node;
+	}
+	update(node);
+}
+
+std::uint32_t Manager::Order::remove(std::uint32_t node, std::uint32_t position, const std::vector<Password> &entries){
+	if(node == NO_NODE)
+		return NO_NODE;
+	if(node == position)
+		return merge(nodes[node].left, nodes[node].right);
+
+	if(entries[position] < entries[node])
+		nodes[node].left = remove(nodes[node].left, position, entries);
+	else
+		nodes[node].right = remove(nodes[node].right, position, entries);
+	update(node);
+	return node;
+}
+
+std::uint32_t Manager::Order::random(){
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+// what the fuzzy search looks at, usernames live in the eagerly decrypted part so lazy mode isn't affected
+static std::vector<std::string_view> searchable(const Password &pw){
+	return {pw.name(), pw.username()};
+}
+
 Manager::Manager(const std::string &fname)
 	:dbname(Manager::real_db_path(fname))
 	,dbdir(fname)
+	,journalname(Manager::real_journal_path(fname))
+	,vaultkey()
+	,dbversion(DB_VERSION)
+	,compression(DB_COMPRESSION)
+	,journal_records(0)
+	,last_backup(0)
+	,pinned(0)
+	,generation(0)
+	,journal_length(0)
+	,entries(std::make_shared<std::vector<Password>>())
+	,indexed(false)
+	,order(new Order())
 	,words(get_resource_dir() + "/american-english", std::ifstream::binary)
+	,busy(false)
+	,stopping(false)
+	,unsaved(false)
 {
 	// make the folders
 	makefolder(fname);
@@ -56,185 +769,1075 @@ Manager::Manager(const std::string &fname)
 	if(!in)
 		throw Manager::NotFound();
 
+	// find the newest backup once, so save() doesn't have to list the folder to know if there's one for today
+	for(const std::string &e : get_backups(dbdir)){
+		long long day;
+		if(backup_date(e, day) && day > last_backup)
+			last_backup = day;
+	}
+
 	srand(time(NULL));
+
+	worker = std::thread(&Manager::persist, this);
 }
 
-void Manager::open(const std::string &mp){
-	masterp = mp;
-	entries = Manager::read(dbname, masterp);
+Manager::~Manager(){
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		// a write failed and nothing has been saved in full since, try once more so changes the user saw go through aren't lost
+		if(unsaved && !pending.snapshot)
+			snapshot();
+		stopping = true;
+	}
+
+	// the persistence thread finishes whatever is still queued before exiting
+	cv.notify_one();
+	worker.join();
+}
+
+// the key is derived once here and cached for every save afterwards
+// lazy mode leaves the passwords encrypted in memory, they're decrypted when Password::password() is called
+void Manager::open(const std::string &mp, bool lazy){
+	// what the persistence thread reads is only set under <lock>
+	crypto::secret key;
+	unsigned version;
+	unsigned comp;
+	unsigned long long gen;
+	entries = std::make_shared<std::vector<Password>>(Manager::read(dbname, mp, key, version, comp, gen, lazy));
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		masterp = mp;
+		vaultkey = key;
+		dbversion = version;
+		compression = comp;
+		generation = gen;
+	}
+
+	reindex();
+	unsigned long long length;
+	const int replayed = replay(gen, length);
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		journal_records = replayed;
+		journal_length = length;
+	}
+
+	if(version < DB_VERSION){
+		// legacy database, keyed by the master password directly, rewrite it in the current format
+		key = derive_key(mp);
+
+		// the file as it was is kept in full as the day's backup, like older versions made them, so it can still be
+		// restored through Manager::read if the upgrade loses anything. the rewrite then doesn't make another one today
+		const QDate &now = QDate::currentDate();
+		const std::string backup = dbdir + "/" + backup_name(now);
+		QDir(dbdir.c_str()).remove((backup_name(now) + ".tmp").c_str());
+		if(!keepfile(dbname, backup + ".tmp") || !replacefile(backup + ".tmp", backup) || !syncdir(dbdir))
+			throw ManagerException("could not keep \"" + dbname + "\" as \"" + backup + "\" before upgrading it");
+
+		std::lock_guard<std::mutex> guard(lock);
+		last_backup = now.toJulianDay();
+		vaultkey = key;
+		dbversion = DB_VERSION;
+		compression = DB_COMPRESSION;
+		snapshot();
+		cv.notify_one();
+	}
+}
+
+// instead of open(), take the entries from an agent that already has the database unlocked, false if there's none running
+// nothing is decrypted here and nothing is written from here afterwards, the agent does it
+// only the names and user names come over, find() fetches a password when it's viewed
+// the master password stays with the agent, so backups can't be read
+bool Manager::attach(){
+	try{
+		remote.reset(new agent::client(agent::path(dbdir)));
+	}catch(const NotFound&){
+		return false;
+	}
+
+	std::vector<Password> copy;
+	remote->snapshot(copy);
+	entries = std::make_shared<std::vector<Password>>(std::move(copy));
+	reindex();
+	return true;
 }
 
 const std::vector<Password> &Manager::get()const{
-	return entries;
+	return *entries;
+}
+
+void Manager::add(const Password &pw){
+	// make sure it doesn't already exist
+	const std::string name(pw.name());
+	if(index.count(name) > 0)
+		throw ManagerException("There is already an entry for \"" + name + "\" in the database!");
+
+	if(remote)
+		remote->add(pw);
+	pin();
+	put(pw);
+	log('a', pw);
+}
+
+// attached to an agent, the entries have no passwords, the agent is asked for the one entry wanted when it's looked up
+const Password &Manager::find(const std::string &name)const{
+	if(remote){
+		fetched = remote->find(name);
+		return fetched;
+	}
+
+	const auto it = index.find(name);
+	if(it != index.end())
+		return entries->at(it->second);
+
+	throw ManagerException("Could not find a password with name \"" + name + "\"");
+}
+
+// positions in get(), sorted by name
+std::vector<std::vector<Password>::size_type> Manager::sorted()const{
+	return order->list();
+}
+
+// position in get() of the entry with the <rank>th name
+std::vector<Password>::size_type Manager::sorted(std::vector<Password>::size_type rank)const{
+	return order->at(rank);
+}
+
+// positions of up to <limit> entries whose name or username resemble <query>, best match first
+// the trigram index is built here the first time, so unlocking doesn't wait for it and the cli never builds it
+std::vector<std::vector<Password>::size_type> Manager::fuzzy(const std::string &query, unsigned limit)const{
+	if(!indexed){
+		const std::vector<Password> &all = *entries;
+		grams.build(all.size(), [&all](std::uint32_t i){
+			return searchable(all[i]);
+		});
+		indexed = true;
+	}
+
+	std::vector<std::uint32_t> ids;
+	grams.rank(query, limit, ids);
+
+	return std::vector<std::vector<Password>::size_type>(ids.begin(), ids.end());
+}
+
+// where the database lives unless told otherwise, shared by the gui and passwords-cli
+std::string Manager::default_path(){
+	return get_db_dir();
+}
+
+// names of the backups, oldest first
+std::vector<std::string> Manager::backups()const{
+	std::vector<std::tuple<long long, unsigned, std::string>> dated;
+	for(const std::string &e : get_backups(dbdir)){
+		long long day;
+		unsigned sequence;
+		if(backup_date(e, day, &sequence))
+			dated.push_back({day, sequence, e});
+	}
+	std::sort(dated.begin(), dated.end());
+
+	std::vector<std::string> names;
+	for(const auto &backup : dated)
+		names.push_back(std::get<2>(backup));
+
+	return names;
+}
+
+// the entries as of the start of the given day, from the newest backup made on or before it, in name order
+// a day's backup holds the entries as they were before that day's first change, see Manager::pin(). the current entries are left alone
+std::vector<Password> Manager::restore(int year, int month, int day)const{
+	const QDate date(year, month, day);
+	if(!date.isValid())
+		throw NotFound();
+
+	// the day's own backup rather than one replace() made later that day
+	std::string newest;
+	long long newest_day = 0;
+	unsigned newest_sequence = 0;
+	for(const std::string &e : get_backups(dbdir)){
+		long long backup_day;
+		unsigned sequence;
+		if(backup_date(e, backup_day, &sequence) && backup_day <= date.toJulianDay() &&
+			(backup_day > newest_day || (backup_day == newest_day && sequence < newest_sequence))){
+			newest = e;
+			newest_day = backup_day;
+			newest_sequence = sequence;
+		}
+	}
+	if(newest.empty())
+		throw NotFound();
+
+	return restore(newest);
+}
+
+// the entries of the backup named <name>, one of the names backups() lists, in name order
+std::vector<Password> Manager::restore(const std::string &name)const{
+	long long day;
+	if(!backup_date(name, day) || !QDir(dbdir.c_str()).exists(name.c_str()))
+		throw NotFound();
+
+	if(remote)
+		throw ManagerException("The agent has the database open, backups need it opened with the master password");
+	return Manager::read_backup(dbdir, name, masterp);
+}
+
+// swap in a whole new set of entries, like the ones restore() returns, and rewrite the database with them
+// the entries being replaced are always backed up first. if the day already has its backup, or one is on its way, they're
+// kept as another backup of the day instead, so restoring twice in a day, or after a change, can still be undone
+void Manager::replace(std::vector<Password> &&replacement){
+	if(remote)
+		throw ManagerException("The agent has the database open, stop it before replacing every entry");
+
+	std::unordered_set<std::string_view> names;
+	names.reserve(replacement.size());
+	for(const Password &pw : replacement){
+		if(!names.insert(pw.name()).second)
+			throw ManagerException("There is more than one entry for \"" + std::string(pw.name()) + "\"");
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		const long long today = QDate::currentDate().toJulianDay();
+		if(today == last_backup || today == pinned)
+			pending.replaced.push_back(entries);
+	}
+	pin();
+	entries = std::make_shared<std::vector<Password>>(std::move(replacement));
+	reindex();
+
+	std::lock_guard<std::mutex> guard(lock);
+	snapshot();
+	cv.notify_one();
+}
+
+// what changed from the backup named <from> to the backup named <to>, an empty name meaning the open database
+// <change> gets (NULL, entry) for an added entry, (entry, NULL) for a removed one and (old, new) when the user name or password changed
+// both sides come in name order, so it's one merge pass, and chunked backups are never held in memory whole
+void Manager::diff(const std::string &from, const std::string &to, const std::function<void(const Password*, const Password*)> &change)const{
+	if(remote)
+		throw ManagerException("The agent has the database open, backups need it opened with the master password");
+
+	const auto open = [this](const std::string &name){
+		return name.empty() ? std::make_unique<Reader>(*this) : std::make_unique<Reader>(dbdir, name, masterp);
+	};
+	const std::unique_ptr<Reader> before = open(from);
+	const std::unique_ptr<Reader> after = open(to);
+
+	Password old;
+	Password current;
+	bool left = before->next(old);
+	bool right = after->next(current);
+	while(left || right){
+		if(right && (!left || current < old)){
+			change(NULL, &current);
+			right = after->next(current);
+		}
+		else if(left && (!right || old < current)){
+			change(&old, NULL);
+			left = before->next(old);
+		}
+		else{
+			if(old.username() != current.username() || old.password() != current.password())
+				change(&old, &current);
+			left = before->next(old);
+			right = after->next(current);
+		}
+	}
+}
+
+void Manager::edit(const std::string &name, const std::string &newname, const std::string &newusrname, const std::string &newpass){
+	// find it
+	const auto it = index.find(name);
+	if(it == index.end())
+		throw ManagerException("Could not edit, because that name/password combo does not exist!");
+
+	if(newname != name && index.count(newname) > 0)
+		throw ManagerException("There is already an entry for \"" + newname + "\" in the database!");
+
+	if(remote)
+		remote->edit(name, newname, newusrname, newpass);
+
+	pin();
+	const auto position = it->second;
+	Password &pass = modify().at(position);
+
+	Password old;
+	old.set_name(name);
+
+	if(newname != name)
+		unplace(position);
+	pass.set_name(newname);
+	pass.set_username(newusrname);
+	pass.set_password(newpass);
+	if(indexed){
+		grams.remove(position);
+		grams.add(position, searchable(pass));
+	}
+	if(newname != name){
+		index.erase(it);
+		index[newname] = position;
+		place(position);
+	}
+
+	log('e', pass, &old);
+}
+
+void Manager::remove(const std::string &name){
+	// find it
+	if(index.count(name) == 0)
+		throw ManagerException("Could not remove, because that name/password combo does not exist!");
+
+	if(remote)
+		remote->remove(name);
+
+	pin();
+	Password old;
+	old.set_name(name);
+
+	erase(name);
+	log('r', old);
+}
+
+// change the master password to <mp>, IncorrectPassword unless <current> is the one it is now
+void Manager::master(const std::string &current, const std::string &mp){
+	if(remote){
+		remote->master(current, mp);
+		return;
+	}
+
+	if(current.length() != masterp.length() || CRYPTO_memcmp(current.data(), masterp.data(), current.length()) != 0)
+		throw IncorrectPassword();
+
+	master(current, mp, derive_key(mp));
+}
+
+// master() with <key> already derived from <mp> by derive_key(), so the slow part can be done on another thread
+void Manager::master(const std::string &current, const std::string &mp, const crypto::secret &key){
+	if(current.length() != masterp.length() || CRYPTO_memcmp(current.data(), masterp.data(), current.length()) != 0)
+		throw IncorrectPassword();
+
+	std::lock_guard<std::mutex> guard(lock);
+	masterp = mp;
+	vaultkey = key;
+	snapshot();
+	cv.notify_one();
+}
+
+// the key a database with the master password <mp> is sealed with, it takes about UNLOCK_MILLISECONDS and touches no Manager
+crypto::secret Manager::derive_key(const std::string &mp){
+	try{
+		return crypto::derive(mp, crypto::calibrate(UNLOCK_MILLISECONDS));
+	}catch(const crypto::exception &e){
+		throw ManagerException(e.what());
+	}
+}
+
+std::string Manager::gen_random(){
+	std::string r;
+
+	for(int i = 0; i < 25; ++i)
+		r.push_back('!' + (rand() % ('~' - '!' + 1)));
+
+	return r;
+}
+
+std::string Manager::gen_memorable(){
+	if(!words)
+		throw ManagerException("Could not open the words file");
+
+	std::string phrase;
+	for(int i = 0; i < 4; ++i)
+		phrase += getword();
+
+	return phrase;
+}
+
+void Manager::generate(const std::string &path, const std::string &master){
+	{
+		std::ofstream out(Manager::real_db_path(path), std::ofstream::binary);
+		if(!out)
+			throw Manager::ManagerException("Could not open " + Manager::real_db_path(path) + " in write mode!");
+	}
+
+	// nothing's been opened, so there's no master password to give yet
+	Manager m(path);
+	m.master("", master);
+	m.flush();
+}
+
+// block until the persistence thread has written everything, rethrows its last failure
+void Manager::flush(){
+	if(remote){
+		remote->flush();
+		return;
+	}
+
+	std::unique_lock<std::mutex> guard(lock);
+	idle.wait(guard, [this]{
+		return !busy && !pending.snapshot && pending.records.empty();
+	});
+
+	if(error.length() > 0){
+		const std::string reason = error;
+		error.clear();
+		throw ManagerException(reason);
+	}
+}
+
+// <callback> is invoked from the persistence thread after every write
+void Manager::on_save(const std::function<void(bool, const std::string&)> &cb){
+	std::lock_guard<std::mutex> guard(callback_lock);
+	callback = cb;
+}
+
+// persistence thread
+// everything queued while a write is in progress is picked up as one job, so bursts of edits coalesce
+void Manager::persist(){
+	std::unique_lock<std::mutex> guard(lock);
+
+	for(;;){
+		cv.wait(guard, [this]{
+			return stopping || pending.snapshot || !pending.records.empty();
+		});
+
+		if(!pending.snapshot && pending.records.empty())
+			return;
+
+		job current = std::move(pending);
+		pending = job();
+		busy = true;
+		// the day of the newest backup is read as the job starts, not when it's queued, a save queued during the one
+		// making today's backup mustn't make it again
+		const long long backed_up = last_backup;
+		unsigned long long gen = generation;
+		unsigned long long length = journal_length;
+		guard.unlock();
+
+		bool success = true;
+		const bool full = current.snapshot != nullptr;
+		std::string message;
+		try{
+			if(full)
+				save(*current.snapshot, current.backup ? *current.backup : *current.snapshot, current.replaced, current.key, current.compression, backed_up, gen, length);
+			if(!current.records.empty())
+				append(current.records, current.key, gen, length);
+		}catch(const std::exception &e){
+			success = false;
+			message = e.what();
+		}
+		current.snapshot.reset();
+
+		{
+			std::lock_guard<std::mutex> cbguard(callback_lock);
+			if(callback)
+				callback(success, message);
+		}
+
+		guard.lock();
+		busy = false;
+		generation = gen;
+		journal_length = length;
+		// a day's backup that didn't get written, because the job had no full save or it failed, goes with the next one
+		if(current.backup && (!full || !success) && !pending.backup)
+			pending.backup = std::move(current.backup);
+		current.backup.reset();
+		// and so do the entries replace() swapped out, ahead of any it swapped out since
+		if(!current.replaced.empty() && (!full || !success))
+			pending.replaced.insert(pending.replaced.begin(), current.replaced.begin(), current.replaced.end());
+		current.replaced.clear();
+		if(!success){
+			error = message;
+			// the journal may be missing records now, so the next change rewrites the whole database, and so does ~Manager
+			journal_records = JOURNAL_MAX_RECORDS;
+			unsaved = true;
+		}
+		else if(full)
+			unsaved = false;
+		idle.notify_all();
+	}
+}
+
+// queue a full save of the current entries, folding in any queued journal records
+// caller must hold <lock>
+void Manager::snapshot(){
+	pending.snapshot = entries;
+	pending.records.clear();
+	pending.key = vaultkey;
+	pending.compression = compression;
+	journal_records = 0;
+}
+
+// the day's backup is of the entries as they were before its first change, so they're held on to here, before the first
+// change is made, until the save that change queues writes them out. the change itself then copies them, see modify()
+void Manager::pin(){
+	if(remote)
+		return;
+
+	std::lock_guard<std::mutex> guard(lock);
+	const long long today = QDate::currentDate().toJulianDay();
+	if(today != last_backup && today != pinned){
+		pending.backup = entries;
+		pinned = today;
+	}
+}
+
+// copy-on-write, the persistence thread may still be writing out a snapshot of the entries
+std::vector<Password> &Manager::modify(){
+	if(entries.use_count() > 1)
+		entries = std::make_shared<std::vector<Password>>(*entries);
+
+	return *entries;
+}
+
+// write a full snapshot to "db" and discard the journal, and if there's no backup for today yet, write <backup> as that
+// each of <replaced> is written as another backup of today, before "db" stops holding it
+// the snapshot goes to a temporary file first and is renamed over "db", so "db" is always either the old or the new database
+// every snapshot gets a new generation, so if the journal outlives the save it's known to be stale, see Manager::replay()
+// <gen> and <journal> are updated as soon as the new database is in place, even if the save fails after that
+void Manager::save(const std::vector<Password> &snapshot, const std::vector<Password> &backup_entries, const std::vector<std::shared_ptr<const std::vector<Password>>> &replaced, const crypto::secret &key, unsigned compression, long long backed_up, unsigned long long &gen, unsigned long long &journal){
+	unsigned long long next;
+	try{
+		crypto::random((unsigned char*)&next, sizeof(next));
+	}catch(const crypto::exception&){
+		throw Corrupt();
+	}
+
+	const std::string tmpname = dbname + ".tmp";
+	Manager::write(tmpname, snapshot, key, compression, next);
+	if(!syncfile(tmpname))
+		throw ManagerException("could not flush \"" + tmpname + "\" to the disk");
+	CRASHPOINT("save written");
+
+	// the first save of the day makes that day's backup
+	const QDate &now = QDate::currentDate();
+	const bool backup = now.toJulianDay() != backed_up;
+	if(backup)
+		Manager::write_backup(dbdir, backup_name(now), backup_entries, key);
+	unsigned sequence = 1;
+	for(const auto &old : replaced){
+		while(QDir(dbdir.c_str()).exists(backup_name(now, sequence).c_str()))
+			++sequence;
+		Manager::write_backup(dbdir, backup_name(now, sequence), *old, key);
+	}
+
+	if(!replacefile(tmpname, dbname))
+		throw ManagerException("could not move \"" + tmpname + "\" to \"" + dbname + "\"");
+	CRASHPOINT("save replaced");
+	if(!syncdir(dbdir))
+		throw ManagerException("could not flush \"" + dbdir + "\" to the disk");
+	gen = next;
+	journal = 0;
+	CRASHPOINT("save synced");
+
+	QDir dir(dbdir.c_str());
+	if(dir.exists("journal") && !dir.remove("journal"))
+		throw ManagerException("could not remove \"" + journalname + "\"");
+	CRASHPOINT("save removed journal");
+
+	if(backup){
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			last_backup = now.toJulianDay();
+		}
+		prune(dbdir);
+	}
+}
+
+// queue a single change record for the journal instead of rewriting the whole database
+// 'a' = add <pw>, 'e' = edit <old> to <pw>, 'r' = remove <pw>
+// the record is [op][field count][packed <old>][packed <pw>]
+void Manager::log(char op, const Password &pw, const Password *old){
+	// the agent has already written it
+	if(remote)
+		return;
+
+	std::string data(1, op);
+	Password::put_varint(data, RECORD_FIELDS);
+	if(old != NULL)
+		old->pack(data);
+	pw.pack(data);
+
+	// the first change of a day rewrites the whole database, that save also makes the day's backup
+	std::lock_guard<std::mutex> guard(lock);
+	if(journal_records >= JOURNAL_MAX_RECORDS || QDate::currentDate().toJulianDay() != last_backup){
+		snapshot();
+	}
+	else{
+		pending.records.push_back(data);
+		pending.key = vaultkey;
+		++journal_records;
+	}
+
+	cv.notify_one();
+}
+
+// encrypt journal records and append them to the journal
+// the journal is [magic][generation of the database it goes with][records...], each record is [length][iv][ciphertext + gcm tag]
+// <journal> is how much of it is good: 0 starts a new one over whatever is there, and anything past it, the torn tail of an
+// append that failed, is cut off first. it's moved past the records once they're on the disk
+void Manager::append(const std::vector<std::string> &records, const crypto::secret &key, unsigned long long gen, unsigned long long &journal){
+	const bool created = journal == 0;
+	if(!created && Manager::filesize(journalname) != (long long)journal && !truncatefile(journalname, journal))
+		throw ManagerException("Could not truncate \"" + journalname + "\"!");
+
+	std::ofstream out(journalname, std::ofstream::binary | (created ? std::ofstream::trunc : std::ofstream::app));
+	if(!out)
+		throw ManagerException("Could not open \"" + journalname + "\" for writing!");
+	CRASHPOINT("append opened");
+
+	unsigned long long length = journal;
+	if(created){
+		out.write(JOURNAL_MAGIC, 4);
+		out.write((char*)&gen, sizeof(gen));
+		length = 4 + sizeof(gen);
+	}
+
+	for(const std::string &data : records){
+		std::vector<unsigned char> raw;
+		std::vector<unsigned char> ciphertext;
+		raw.resize(data.length());
+		memcpy(raw.data(), data.c_str(), data.length());
+
+		unsigned char iv[crypto::GCM_IV_SIZE];
+		try{
+			crypto::random(iv, sizeof(iv));
+			crypto::seal(key, iv, raw, ciphertext);
+		}catch(const crypto::exception&){
+			throw Corrupt();
+		}
+
+		const unsigned long long sealed = ciphertext.size();
+		out.write((char*)&sealed, sizeof(sealed));
+		out.write((char*)iv, sizeof(iv));
+		out.write((char*)ciphertext.data(), ciphertext.size());
+		length += sizeof(sealed) + sizeof(iv) + sealed;
+	}
+
+	out.close();
+	CRASHPOINT("append written");
+	if(!out || !syncfile(journalname))
+		throw ManagerException("Could not write to \"" + journalname + "\"!");
+	CRASHPOINT("append synced");
+	// a new journal's directory entry has to reach the disk too, or the records in it could be lost with it
+	if(created && !syncdir(dbdir))
+		throw ManagerException("could not flush \"" + dbdir + "\" to the disk");
+	journal = length;
+}
+
+// serialize the database and encrypt it in independent segments, so it can be decrypted in parallel
+// layout is [magic][version][kdf iterations][kdf salt][compression][generation][segments...][directory iv][directory][directory offset][directory length]
+// the version is DB_VERSION in the low 16 bits and DB_REVISION above them, see Manager::read
+// each segment is an index part (names and user names) followed by a secrets part (passwords), sealed separately with AES-256-GCM,
+// so the passwords can stay encrypted in memory until they're needed
+// each part is [field count] followed by the packed records, see Password::pack, and is deflated before it's sealed if <compression> says so
+// the directory lists the offset, part lengths, ivs and entry count of each segment and is sealed as well
+// the header needs no authentication of its own, altering the kdf parameters changes the key and altering the generation only
+// loses the journal, which whoever can write the header could delete anyway
+void Manager::write(const std::string &file, const std::vector<Password> &entries, const crypto::secret &key, unsigned compression, unsigned long long generation){
+	std::ofstream out(file, std::ofstream::binary);
+	if(!out)
+		throw ManagerException("Could not open \"" + file + "\" for writing!");
+
+	const unsigned version = DB_VERSION | DB_REVISION << 16;
+	out.write(DB_MAGIC, 4);
+	out.write((char*)&version, sizeof(version));
+	out.write((char*)&key.params.iterations, sizeof(key.params.iterations));
+	out.write((char*)key.params.salt, sizeof(key.params.salt));
+	out.write((char*)&compression, sizeof(compression));
+	out.write((char*)&generation, sizeof(generation));
+
+	unsigned long long offset = out.tellp();
+	std::vector<unsigned char> directory;
+	std::vector<unsigned char> raw;
+	std::vector<unsigned char> ciphertext;
+	unsigned count = 0;
+
+	std::string index;
+	std::string secrets;
+	index.reserve(SEGMENT_SIZE);
+	secrets.reserve(SEGMENT_SIZE);
+
+	const auto start = [&](){
+		index.clear();
+		secrets.clear();
+		Password::put_varint(index, INDEX_FIELDS);
+		Password::put_varint(secrets, SECRETS_FIELDS);
+		count = 0;
+	};
+	start();
+
+	// seal <part> and send it to the file, returns the sealed length
+	std::unique_ptr<Deflater> deflater;
+	if(compression == COMPRESSION_ZLIB)
+		deflater.reset(new Deflater);
+
+	const auto seal = [&](const std::string &part, unsigned char *iv){
+		if(deflater)
+			deflater->run(part, raw);
+		else
+			raw.assign(part.begin(), part.end());
+
+		try{
+			crypto::random(iv, crypto::GCM_IV_SIZE);
+			crypto::seal(key, iv, raw, ciphertext);
+		}catch(const crypto::exception&){
+			throw Corrupt();
+		}
+
+		out.write((char*)ciphertext.data(), ciphertext.size());
+		return (unsigned long long)ciphertext.size();
+	};
+
+	const auto flush = [&](){
+		unsigned char index_iv[crypto::GCM_IV_SIZE];
+		unsigned char secrets_iv[crypto::GCM_IV_SIZE];
+		const unsigned long long index_length = seal(index, index_iv);
+		const unsigned long long secrets_length = seal(secrets, secrets_iv);
+
+		directory.insert(directory.end(), (unsigned char*)&offset, (unsigned char*)&offset + sizeof(offset));
+		directory.insert(directory.end(), (unsigned char*)&index_length, (unsigned char*)&index_length + sizeof(index_length));
+		directory.insert(directory.end(), (unsigned char*)&secrets_length, (unsigned char*)&secrets_length + sizeof(secrets_length));
+		directory.insert(directory.end(), index_iv, index_iv + sizeof(index_iv));
+		directory.insert(directory.end(), secrets_iv, secrets_iv + sizeof(secrets_iv));
+		directory.insert(directory.end(), (unsigned char*)&count, (unsigned char*)&count + sizeof(count));
+
+		offset += index_length + secrets_length;
+		start();
+	};
+
+	// in name order. the entries of a segment that was written that way are still next to each other in it however the
+	// entries have been moved around since, so passwords that are still sealed only need a segment or two decrypted at a time
+	Unsealer passwords(entries);
+	for(const std::vector<Password>::size_type position : by_name(entries)){
+		const Password &pw = entries[position];
+		Password::put_field(index, pw.name());
+		Password::put_field(index, pw.username());
+		Password::put_field(secrets, passwords.password(pw));
+
+		++count;
+		if(index.length() + secrets.length() >= SEGMENT_SIZE)
+			flush();
+	}
+	if(count > 0)
+		flush();
+
+	// the directory
+	unsigned char iv[crypto::GCM_IV_SIZE];
+	try{
+		crypto::random(iv, sizeof(iv));
+		crypto::seal(key, iv, directory, ciphertext);
+	}catch(const crypto::exception&){
+		throw Corrupt();
+	}
+
+	const unsigned long long length = sizeof(iv) + ciphertext.size();
+	out.write((char*)iv, sizeof(iv));
+	out.write((char*)ciphertext.data(), ciphertext.size());
+	out.write((char*)&offset, sizeof(offset));
+	out.write((char*)&length, sizeof(length));
+
+	out.close();
+	if(!out)
+		throw ManagerException("Could not write to \"" + file + "\"!");
 }
 
-void Manager::add(const Password &pw){
-	// make sure it doesn't already exist
-	for(const Password &pass : entries){
-		if(pass.name() == pw.name())
-			throw ManagerException("There is already an entry for \"" + pass.name() + "\" in the database!");
-	}
+// store <entries> as the backup <dir>/<name>, see Manifest
+// the packed records are cut into chunks, and each chunk that isn't in <dir>/chunks yet is deflated, sealed and stored there
+// under its mac, so a backup of a database that barely changed since the last one costs a few chunks and a small manifest
+// the records are packed as they're chunked, so no more than a chunk or two of them is ever in memory decrypted
+void Manager::write_backup(const std::string &dir, const std::string &name, const std::vector<Password> &entries, const crypto::secret &key){
+	const std::string chunkdir = dir + "/chunks";
+	makefolder(chunkdir);
+	std::unordered_set<std::string> stored;
+	for(const auto &entry : QDir(chunkdir.c_str()).entryList())
+		stored.insert(entry.toStdString());
+
+	std::string macs;
+	unsigned long long count = 0;
+	unsigned long long length = 0;
+	bool added = false;
+	Deflater deflater;
+	std::vector<unsigned char> raw;
+	std::vector<unsigned char> ciphertext;
 
-	entries.push_back(pw);
-	save();
-}
+	// a boundary only depends on the CHUNK_MAX bytes after the one before it, so cutting once that much is buffered puts
+	// the boundaries exactly where cutting the whole of the records at once would
+	std::string records;
+	const auto cut = [&](bool last){
+		std::string_view rest = records;
+		while(rest.length() > 0 && (last || rest.length() >= CHUNK_MAX)){
+			const std::string_view piece = rest.substr(0, chunk(rest));
+			rest.remove_prefix(piece.length());
+			length += piece.length();
+
+			unsigned char mac[crypto::MAC_SIZE];
+			unsigned char iv[crypto::GCM_IV_SIZE];
+			try{
+				crypto::mac(key, "backup chunk", (const unsigned char*)piece.data(), piece.length(), mac);
+			}catch(const crypto::exception&){
+				throw Corrupt();
+			}
+			macs.append((char*)mac, sizeof(mac));
+			++count;
 
-const Password &Manager::find(const std::string &name)const{
-	for(const Password &pass : entries){
-		if(pass.name() == name)
-			return pass;
-	}
+			const std::string chunkname = hex(mac, sizeof(mac));
+			if(stored.count(chunkname) != 0)
+				continue;
 
-	throw ManagerException("Could not find a password with name \"" + name + "\"");
-}
+			deflater.run(piece, raw);
+			try{
+				crypto::random(iv, sizeof(iv));
+				crypto::seal(key, iv, raw, ciphertext);
+			}catch(const crypto::exception&){
+				throw Corrupt();
+			}
 
-void Manager::edit(const std::string &name, const std::string &newname, const std::string &newusrname, const std::string &newpass){
-	// find it
-	for(Password &pass : entries){
-		if(name == pass.name()){
-			pass.set_name(newname);
-			pass.set_username(newusrname);
-			pass.set_password(newpass);
-			save();
-			return;
+			// a chunk is only ever visible under its name once it's complete
+			const std::string path = chunkdir + "/" + chunkname;
+			std::ofstream out(path + ".tmp", std::ofstream::binary);
+			out.write((char*)iv, sizeof(iv));
+			out.write((char*)ciphertext.data(), ciphertext.size());
+			out.close();
+			if(!out || !syncfile(path + ".tmp") || !replacefile(path + ".tmp", path))
+				throw ManagerException("could not write \"" + path + "\"");
+
+			stored.insert(chunkname);
+			added = true;
 		}
+		records.erase(0, records.length() - rest.length());
+	};
+
+	// in name order, so two backups can be compared without loading either of them, see Manager::diff()
+	Unsealer passwords(entries);
+	Password::put_varint(records, RECORD_FIELDS);
+	for(const std::vector<Password>::size_type i : by_name(entries)){
+		const Password &pw = entries[i];
+		Password::put_field(records, pw.name());
+		Password::put_field(records, pw.username());
+		Password::put_field(records, passwords.password(pw));
+		cut(false);
 	}
+	cut(true);
 
-	// couldn't find it
-	throw ManagerException("Could not edit, because that name/password combo does not exist!");
-}
+	if(added && !syncdir(chunkdir))
+		throw ManagerException("could not flush \"" + chunkdir + "\" to the disk");
 
-void Manager::remove(const std::string &name){
-	// find it
-	for(auto it = entries.begin(); it != entries.end();){
-		if(name == (*it).name()){
-			it = entries.erase(it);
-			save();
-			return;
-		}
+	const unsigned version = BACKUP_VERSION;
+	std::string manifest(BACKUP_MAGIC);
+	manifest.append((char*)&version, sizeof(version));
+	manifest.append((char*)&key.params.iterations, sizeof(key.params.iterations));
+	manifest.append((char*)key.params.salt, sizeof(key.params.salt));
+	manifest.append((char*)&length, sizeof(length));
+	manifest.append((char*)&count, sizeof(count));
+	manifest.append(macs);
 
-		++it;
+	unsigned char mac[crypto::MAC_SIZE];
+	try{
+		crypto::mac(key, "backup manifest", (const unsigned char*)manifest.data(), manifest.length(), mac);
+	}catch(const crypto::exception&){
+		throw Corrupt();
 	}
-
-	// couldn't find it
-	throw ManagerException("Could not remove, because that name/password combo does not exist!");
-}
-
-void Manager::master(const std::string &mp){
-	masterp = mp;
-	save();
+	manifest.append((char*)mac, sizeof(mac));
+
+	const std::string path = dir + "/" + name;
+	std::ofstream out(path + ".tmp", std::ofstream::binary);
+	out.write(manifest.data(), manifest.length());
+	out.close();
+	if(!out || !syncfile(path + ".tmp") || !replacefile(path + ".tmp", path))
+		throw ManagerException("could not write \"" + path + "\"");
 }
 
-std::string Manager::get_master()const{
-	return masterp;
-}
+// whether all of the next record is at the front of <rest>, or just the field count if <fields> isn't known yet
+static bool buffered(std::string_view rest, unsigned long long fields){
+	std::string_view::size_type pos = 0;
+	const auto varint = [&rest, &pos](unsigned long long &value){
+		value = 0;
+		for(unsigned shift = 0; shift < 64 && pos < rest.length(); shift += 7){
+			const unsigned char byte = rest[pos++];
+			value |= (unsigned long long)(byte & 0x7f) << shift;
+			if((byte & 0x80) == 0)
+				return true;
+		}
+		return false;
+	};
 
-std::string Manager::gen_random(){
-	std::string r;
+	unsigned long long length;
+	if(fields == 0)
+		return varint(length);
 
-	for(int i = 0; i < 25; ++i)
-		r.push_back('!' + (rand() % ('~' - '!' + 1)));
+	for(unsigned long long i = 0; i < fields; ++i){
+		if(!varint(length) || length > rest.length() - pos)
+			return false;
+		pos += length;
+	}
 
-	return r;
+	return true;
 }
 
-std::string Manager::gen_memorable(){
-	if(!words)
-		throw ManagerException("Could not open the words file");
-
-	std::string phrase;
-	for(int i = 0; i < 4; ++i)
-		phrase += getword();
-
-	return phrase;
-}
+// the backup <dir>/<name>, a manifest or a full copy of the database made by an older version
+Manager::Reader::Reader(const std::string &d, const std::string &name, const std::string &master)
+	:dir(d)
+	,streaming(false)
+	,chunk(0)
+	,fields(0)
+	,total(0)
+	,consumed(0)
+	,at(0)
+{
+	const std::string path = dir + "/" + name;
+	if(!load_manifest(path, manifest)){
+		crypto::secret k;
+		unsigned version;
+		unsigned compression;
+		unsigned long long generation;
+		entries = Manager::read(path, master, k, version, compression, generation, false);
+		sort();
+		return;
+	}
 
-void Manager::generate(const std::string &path, const std::string &master){
-	{
-		std::ofstream out(Manager::real_db_path(path), std::ofstream::binary);
-		if(!out)
-			throw Manager::ManagerException("Could not open " + Manager::real_db_path(path) + " in write mode!");
+	unsigned char mac[crypto::MAC_SIZE];
+	try{
+		key = crypto::derive(master, manifest.params);
+		crypto::mac(key, "backup manifest", (const unsigned char*)manifest.body.data(), manifest.body.length(), mac);
+	}catch(const crypto::exception&){
+		throw IncorrectPassword();
 	}
+	if(CRYPTO_memcmp(mac, manifest.mac, sizeof(mac)) != 0)
+		throw IncorrectPassword();
 
-	Manager m(path);
-	m.master(master);
+	streaming = true;
+	if(manifest.version < 2){
+		Password pw;
+		while(next(pw))
+			entries.push_back(pw);
+		streaming = false;
+		sort();
+	}
 }
 
-void Manager::save()const{
-	const std::vector<std::string> &backups = get_backups(dbdir);
-
-	const QDate &now = QDate::currentDate();
-
-	bool today = false;
-	// entries will be of the form YYYY_MM_DD.backup
-	for(const std::string &e : backups){
-		std::string entry;
-		for(const char c : e){
-			if(c == '_')
-				entry.push_back(' ');
-			else
-				entry.push_back(c);
+// the open database, its sealed passwords are decrypted as they're read
+Manager::Reader::Reader(const Manager &mgr)
+	:streaming(false)
+	,chunk(0)
+	,fields(0)
+	,total(0)
+	,consumed(0)
+	,live(mgr.entries)
+	,unsealer(new Unsealer(*mgr.entries))
+	,order(mgr.order->list())
+	,at(0)
+{}
+
+bool Manager::Reader::next(Password &pw){
+	if(!streaming){
+		if(at >= order.size())
+			return false;
+
+		if(live){
+			const Password &entry = (*live)[order[at++]];
+			pw = entry;
+			if(entry.sealed)
+				pw.set_password(unsealer->password(entry));
 		}
+		else
+			pw = entries[order[at++]];
+		return true;
+	}
 
-		int year;
-		int month;
-		int day;
-
-		if(3 != sscanf(entry.c_str(), "%d %d %d", &year, &month, &day))
-			continue;
-
-		if(now.day() == day && now.month() == month && now.year() == year){
-			today = true;
-			break;
+	// decrypt chunks until the next record is whole, then whatever doesn't parse is corrupt
+	// the records start with how many fields each of them has
+	std::string_view rest(buffer);
+	rest.remove_prefix(consumed);
+	for(;;){
+		while(!buffered(rest, fields) && chunk < manifest.chunks.size()){
+			consumed = buffer.length() - rest.length();
+			fill();
+			rest = buffer;
 		}
+		if(fields != 0)
+			break;
+
+		fields = Password::get_varint(rest);
+		if(fields == 0)
+			throw Corrupt();
 	}
+	consumed = buffer.length() - rest.length();
 
-	if(!today){
-		const std::string name = std::to_string(now.year()) + "_" + std::to_string(now.month()) + "_" + std::to_string(now.day()) + ".backup";
-		QDir dir(dbdir.c_str());
-		if(dir.exists("db") && !dir.rename("db", name.c_str()))
-			throw ManagerException("could not move \"db\" to \"" + dbdir + "/" + name + "\"");
+	if(rest.length() == 0){
+		if(total != manifest.length)
+			throw Corrupt();
+		return false;
 	}
 
-	write(dbname);
+	pw.unpack(rest, fields, RECORD_FIELDS);
+	consumed = buffer.length() - rest.length();
+	return true;
 }
 
-void Manager::write(const std::string &file)const{
-	std::string data = "passwordsdb\n";
-	for(const Password &pw : entries){
-		data += pw.serialize();
-	}
+// decrypt the next chunk onto the end of what's left of the buffer
+void Manager::Reader::fill(){
+	buffer.erase(0, consumed);
+	consumed = 0;
 
-	// compile the data
-	std::vector<unsigned char> raw;
-	std::vector<unsigned char> ciphertext;
-	raw.resize(data.length());
-	memcpy(raw.data(), data.c_str(), data.length());
+	const std::string &chunkname = manifest.chunks[chunk++];
+	const std::string chunkpath = dir + "/chunks/" + chunkname;
+	std::ifstream in(chunkpath, std::ifstream::binary);
+	if(!in)
+		throw Corrupt();
 
-	// plaintext checksum
-	unsigned long long plain_checksum = 0;
-	for(const auto c : data)
-		plain_checksum += c;
+	unsigned char iv[crypto::GCM_IV_SIZE];
+	const long long chunklen = Manager::filesize(chunkpath);
+	if(chunklen < (long long)sizeof(iv))
+		throw Corrupt();
+
+	ciphertext.resize(chunklen - sizeof(iv));
+	in.read((char*)iv, sizeof(iv));
+	in.read((char*)ciphertext.data(), ciphertext.size());
+	if(!in)
+		throw Corrupt();
 
-	// encrypt
 	try{
-		crypto::encrypt(masterp, raw, ciphertext);
+		crypto::unseal(key, iv, ciphertext, raw);
 	}catch(const crypto::exception&){
 		throw Corrupt();
 	}
+	inflate_part(raw, plaintext);
 
-	// ciphertext checksum
-	unsigned long long cipher_checksum = 0;
-	for(const auto c : ciphertext)
-		cipher_checksum += c;
+	// a chunk can't be swapped for another one sealed under the same key
+	unsigned char mac[crypto::MAC_SIZE];
+	try{
+		crypto::mac(key, "backup chunk", plaintext.data(), plaintext.size(), mac);
+	}catch(const crypto::exception&){
+		throw Corrupt();
+	}
+	if(hex(mac, sizeof(mac)) != chunkname)
+		throw Corrupt();
 
-	std::ofstream out(file, std::ofstream::binary);
-	if(!out)
-		throw ManagerException("Could not open \"" + file + "\" for writing!");
+	buffer.append((char*)plaintext.data(), plaintext.size());
+	total += plaintext.size();
+	if(total > manifest.length)
+		throw Corrupt();
+}
 
-	out.write((char*)&cipher_checksum, sizeof(cipher_checksum)); // write the ciphertext checksum
-	out.write((char*)&plain_checksum, sizeof(plain_checksum)); // write the plaintext checksum
-	out.write((char*)ciphertext.data(), ciphertext.size());
+void Manager::Reader::sort(){
+	order.resize(entries.size());
+	for(std::vector<Password>::size_type i = 0; i < order.size(); ++i)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [this](std::vector<Password>::size_type a, std::vector<Password>::size_type b){
+		return entries[a] < entries[b];
+	});
+}
+
+// the entries of the backup <dir>/<name>, in name order
+std::vector<Password> Manager::read_backup(const std::string &dir, const std::string &name, const std::string &master){
+	Reader reader(dir, name, master);
+
+	std::vector<Password> entries;
+	Password pw;
+	while(reader.next(pw))
+		entries.push_back(pw);
+
+	return entries;
 }
 
 std::string Manager::getword(){
@@ -262,7 +1865,13 @@ std::string Manager::getword(){
 	return word;
 }
 
-std::vector<Password> Manager::read(const std::string &name, const std::string &master){
+// decrypt and parse the database
+// fills in <key> with the derived key (zero iterations for legacy databases that have no header), <version> with the format version
+// and <generation> with the one the journal has to match, see Manager::replay()
+// legacy databases are [ciphertext checksum][plaintext checksum] and csv encrypted with the master password directly, decrypted
+// one block at a time. anything else is segmented, see Manager::read_segments()
+// with <lazy> set, passwords are left encrypted until they're asked for
+std::vector<Password> Manager::read(const std::string &name, const std::string &master, crypto::secret &key, unsigned &version, unsigned &compression, unsigned long long &generation, bool lazy){
 	std::vector<Password> entries;
 
 	const long long filelen = Manager::filesize(name);
@@ -272,76 +1881,479 @@ std::vector<Password> Manager::read(const std::string &name, const std::string &
 	if(!in)
 		throw Manager::NotFound();
 
-	std::vector<unsigned char> raw;
-	raw.resize(filelen - sizeof(unsigned long long) - sizeof(unsigned long long));
+	char magic[4];
+	in.read(magic, sizeof(magic));
+	if(in && memcmp(magic, DB_MAGIC, sizeof(magic)) == 0){
+		in.read((char*)&version, sizeof(version));
+		in.read((char*)&key.params.iterations, sizeof(key.params.iterations));
+		in.read((char*)key.params.salt, sizeof(key.params.salt));
+		in.read((char*)&compression, sizeof(compression));
+		in.read((char*)&generation, sizeof(generation));
+		// any revision of this version is read the same way, the fields it doesn't know are skipped
+		version &= 0xffff;
+		if(!in || version != DB_VERSION || key.params.iterations == 0 || compression > COMPRESSION_ZLIB)
+			throw Corrupt();
+
+		try{
+			key = crypto::derive(master, key.params);
+		}catch(const crypto::exception&){
+			throw IncorrectPassword();
+		}
+
+		return Manager::read_segments(name, filelen, key, compression, lazy);
+	}
+
+	// databases without a header start right at the checksums
+	in.clear();
+	in.seekg(0);
+	key.params.iterations = 0;
+	version = 0;
+	compression = COMPRESSION_NONE;
+	generation = 0;
 
-	unsigned long long cipher_checksum;
-	unsigned long long plain_checksum;
+	unsigned long long cipher_checksum = 0;
+	unsigned long long plain_checksum = 0;
 	in.read((char*)&cipher_checksum, sizeof(cipher_checksum));
 	in.read((char*)&plain_checksum, sizeof(plain_checksum));
-	in.read((char*)raw.data(), filelen - sizeof(cipher_checksum) - sizeof(plain_checksum));
-
-	// validate cipher checksum
-	unsigned long long chk = 0;
-	for(const auto c : raw)
-		chk += c;
-	if(chk != cipher_checksum)
+	if(!in)
 		throw Corrupt();
 
-	// decrypt
-	std::vector<unsigned char> plaintextdata;
+	long long remaining = filelen - in.tellg();
+
+	std::unique_ptr<crypto::decrypt_stream> decrypt;
+	try{
+		decrypt.reset(new crypto::decrypt_stream(master));
+	}catch(const crypto::exception&){
+		throw IncorrectPassword();
+	}
+
+	std::vector<unsigned char> ciphertext(READ_BLOCK_SIZE);
+	std::vector<unsigned char> plaintext(READ_BLOCK_SIZE + crypto::BLOCK_SIZE);
+	std::string pending; // plaintext that hasn't been terminated by a newline yet
+	bool title = false;
+	unsigned long long cipher_chk = 0;
+	unsigned long long plain_chk = 0;
+
+	// split complete lines out of <pending>, keep the tail for the next block
+	const auto parse = [&](){
+		std::string::size_type start = 0;
+		for(;;){
+			const std::string::size_type end = pending.find('\n', start);
+			if(end == std::string::npos)
+				break;
+
+			if(!title){
+				if(pending.compare(start, end - start, "passwordsdb") != 0)
+					throw IncorrectPassword();
+				title = true;
+			}
+			else if(end != start){
+				entries.emplace_back();
+				entries.back().deserialize(std::string_view(pending.data() + start, end - start));
+			}
+
+			start = end + 1;
+		}
+
+		pending.erase(0, start);
+	};
+
+	while(remaining > 0){
+		const std::streamsize want = remaining < READ_BLOCK_SIZE ? remaining : READ_BLOCK_SIZE;
+		in.read((char*)ciphertext.data(), want);
+		const std::streamsize got = in.gcount();
+		if(got != want)
+			throw Corrupt();
+		remaining -= got;
+
+		for(std::streamsize i = 0; i < got; ++i)
+			cipher_chk += ciphertext[i];
+
+		int written;
+		try{
+			written = decrypt->decrypt(ciphertext.data(), got, plaintext.data(), plaintext.size());
+		}catch(const crypto::exception&){
+			throw IncorrectPassword();
+		}
+
+		for(int i = 0; i < written; ++i)
+			plain_chk += plaintext[i];
+
+		pending.append((char*)plaintext.data(), written);
+		parse();
+	}
+
+	int written;
 	try{
-		crypto::decrypt(master, raw, plaintextdata);
+		written = decrypt->finalize(plaintext.data(), plaintext.size());
 	}catch(const crypto::exception&){
+		// if the title decrypted fine the password was right, so the data must have been tampered with
+		if(title || cipher_chk != cipher_checksum)
+			throw Corrupt();
 		throw IncorrectPassword();
 	}
-	plaintextdata.push_back(0);
-	std::string csv = (char*)plaintextdata.data();
 
-	// validate cipher checksum
-	chk = 0;
-	for(const auto c : plaintextdata)
-		chk += c;
-	if(chk != plain_checksum)
+	for(int i = 0; i < written; ++i)
+		plain_chk += plaintext[i];
+
+	pending.append((char*)plaintext.data(), written);
+	parse();
+
+	// validate checksums
+	if(cipher_chk != cipher_checksum)
+		throw Corrupt();
+	if(plain_chk != plain_checksum || !title)
 		throw IncorrectPassword();
+	if(pending.length() > 0)
+		throw Corrupt();
 
-	if(Manager::getline(csv) != "passwordsdb")
+	return entries;
+}
+
+// decrypt and parse every segment of the database across all cores
+std::vector<Password> Manager::read_segments(const std::string &name, long long filelen, const crypto::secret &key, unsigned compression, bool lazy){
+	// decrypt straight out of the page cache when the file can be mapped, otherwise read each part into a buffer first
+	const Mapping map(mapfile(name, filelen), filelen);
+	const auto fetch = [&map](std::ifstream &file, unsigned long long position, unsigned long long count, std::vector<unsigned char> &buffer)->const unsigned char*{
+		if(map.data != NULL)
+			return map.data + position;
+
+		buffer.resize(count);
+		file.seekg(position);
+		file.read((char*)buffer.data(), count);
+		if(!file)
+			throw Corrupt();
+		return buffer.data();
+	};
+
+	std::ifstream in;
+	if(map.data == NULL){
+		in.open(name, std::ifstream::binary);
+		if(!in)
+			throw Manager::NotFound();
+	}
+
+	// find the directory
+	unsigned long long offset;
+	unsigned long long length;
+	std::vector<unsigned char> buffer;
+	const unsigned char *trailer = fetch(in, filelen - sizeof(offset) - sizeof(length), sizeof(offset) + sizeof(length), buffer);
+	memcpy(&offset, trailer, sizeof(offset));
+	memcpy(&length, trailer + sizeof(offset), sizeof(length));
+	const unsigned long long end = filelen - sizeof(offset) - sizeof(length);
+	if(length < (unsigned)crypto::GCM_IV_SIZE || offset > end || length != end - offset)
+		throw Corrupt();
+
+	const unsigned char *iv = fetch(in, offset, length, buffer);
+	std::vector<unsigned char> directory;
+	try{
+		crypto::unseal(key, iv, iv + crypto::GCM_IV_SIZE, length - crypto::GCM_IV_SIZE, directory);
+	}catch(const crypto::exception&){
 		throw IncorrectPassword();
+	}
+
+	// where to find each segment
+	struct segment{
+		unsigned long long offset;
+		unsigned long long index_length;
+		unsigned long long secrets_length;
+		unsigned char index_iv[crypto::GCM_IV_SIZE];
+		unsigned char secrets_iv[crypto::GCM_IV_SIZE];
+		unsigned count;
+	};
+	const unsigned entrylen = sizeof(segment::offset) + sizeof(segment::index_length) + sizeof(segment::secrets_length) + sizeof(segment::index_iv) + sizeof(segment::secrets_iv) + sizeof(segment::count);
+	if(directory.size() % entrylen != 0)
+		throw Corrupt();
+
+	std::vector<segment> segments(directory.size() / entrylen);
+	for(std::vector<segment>::size_type i = 0; i < segments.size(); ++i){
+		const unsigned char *entry = directory.data() + (i * entrylen);
+		segment &seg = segments[i];
+
+		memcpy(&seg.offset, entry, sizeof(seg.offset));
+		entry += sizeof(seg.offset);
+		memcpy(&seg.index_length, entry, sizeof(seg.index_length));
+		entry += sizeof(seg.index_length);
+		memcpy(&seg.secrets_length, entry, sizeof(seg.secrets_length));
+		entry += sizeof(seg.secrets_length);
+		memcpy(seg.index_iv, entry, sizeof(seg.index_iv));
+		entry += sizeof(seg.index_iv);
+		memcpy(seg.secrets_iv, entry, sizeof(seg.secrets_iv));
+		entry += sizeof(seg.secrets_iv);
+		memcpy(&seg.count, entry, sizeof(seg.count));
+
+		// the parts are read in place when mapped, so the sum can't be allowed to wrap
+		if(seg.index_length > offset || seg.secrets_length > offset - seg.index_length || seg.offset > offset - seg.index_length - seg.secrets_length)
+			throw Corrupt();
+	}
+
+	// each thread claims the next segment until there are none left
+	std::vector<std::vector<Password>> parsed(segments.size());
+	std::atomic<std::vector<segment>::size_type> next(0);
+	std::exception_ptr failure;
+	std::mutex failure_lock;
+
+	const auto work = [&](){
+		std::ifstream file;
+		if(map.data == NULL)
+			file.open(name, std::ifstream::binary);
+		std::vector<unsigned char> ciphertext;
+		std::vector<unsigned char> deflated;
+		std::vector<unsigned char> plaintext;
+
+		for(;;){
+			const auto i = next++;
+			if(i >= segments.size())
+				return;
+
+			try{
+				const segment &seg = segments[i];
+				const unsigned char *index = fetch(file, seg.offset, seg.index_length, ciphertext);
+				try{
+					crypto::unseal(key, seg.index_iv, index, seg.index_length, compression == COMPRESSION_ZLIB ? deflated : plaintext);
+				}catch(const crypto::exception&){
+					throw Corrupt();
+				}
+				if(compression == COMPRESSION_ZLIB)
+					inflate_part(deflated, plaintext);
+
+				std::vector<Password> &entries = parsed[i];
+				entries.reserve(seg.count);
+				Manager::unpack(std::string_view((char*)plaintext.data(), plaintext.size()), entries);
+				if(entries.size() != seg.count)
+					throw Corrupt();
+
+				const unsigned char *secrets = fetch(file, seg.offset + seg.index_length, seg.secrets_length, ciphertext);
+				if(lazy){
+					// the mapping goes away when the file is closed, so a lazy segment keeps its own copy
+					const auto sealed = std::make_shared<const Sealed>(key, seg.secrets_iv, std::vector<unsigned char>(secrets, secrets + seg.secrets_length), compression == COMPRESSION_ZLIB);
+					for(unsigned slot = 0; slot < entries.size(); ++slot){
+						entries[slot].sealed = sealed;
+						entries[slot].slot = slot;
+					}
+				}
+				else{
+					std::vector<std::string> passwords;
+					try{
+						passwords = Sealed::open(key, seg.secrets_iv, secrets, seg.secrets_length, compression == COMPRESSION_ZLIB);
+					}catch(const crypto::exception&){
+						throw Corrupt();
+					}
+					if(passwords.size() != entries.size())
+						throw Corrupt();
+
+					for(std::vector<Password>::size_type j = 0; j < entries.size(); ++j)
+						entries[j].set_password(passwords[j]);
+				}
+			}catch(...){
+				std::lock_guard<std::mutex> guard(failure_lock);
+				if(!failure)
+					failure = std::current_exception();
+				next = segments.size();
+				return;
+			}
+		}
+	};
 
-	while(csv.length() > 0){
-		std::string line = Manager::getline(csv);
+	unsigned threads = std::thread::hardware_concurrency();
+	if(threads > segments.size())
+		threads = segments.size();
 
-		if(line == "" || line == "\n")
-			continue;
+	std::vector<std::thread> pool;
+	for(unsigned i = 1; i < threads; ++i)
+		pool.emplace_back(work);
+	work();
+	for(std::thread &t : pool)
+		t.join();
 
-		Password passwd;
-		passwd.deserialize(line + '\n');
-		entries.push_back(passwd);
+	if(failure)
+		std::rethrow_exception(failure);
+
+	// stitch the segments back together in order
+	std::vector<Password>::size_type total = 0;
+	for(const std::vector<Password> &p : parsed)
+		total += p.size();
+
+	std::vector<Password> entries;
+	entries.reserve(total);
+	for(std::vector<Password> &p : parsed){
+		std::move(p.begin(), p.end(), std::back_inserter(entries));
+		std::vector<Password>().swap(p);
 	}
 
 	return entries;
 }
 
-std::string Manager::getline(std::string& stream){
-	std::string line;
+// parse an index part of packed records, [field count][records...]
+void Manager::unpack(std::string_view part, std::vector<Password> &entries){
+	const unsigned long long fields = Password::get_varint(part);
+	if(fields == 0 && part.length() > 0)
+		throw Corrupt();
+
+	while(part.length() > 0){
+		entries.emplace_back();
+		entries.back().unpack(part, fields, INDEX_FIELDS);
+	}
+}
+
+// apply the journal on top of the snapshot, returns the number of records replayed and sets <length> to how much of it is good
+// replaying a record over a snapshot that already has it isn't harmless, a removed entry would come back and a renamed one would
+// be there under both names. so the journal carries the generation of the snapshot it was started after, and one that doesn't
+// match is what's left of a save that was cut short between replacing "db" and removing the journal, and is removed
+// a torn or undecryptable record ends the journal, it's cut off there so new records don't go after it
+// legacy databases never had a journal, the records are the ones Manager::append writes
+int Manager::replay(unsigned long long gen, unsigned long long &length){
+	length = 0;
+	std::ifstream in(journalname, std::ifstream::binary);
+	if(!in)
+		return 0;
+
+	char magic[4];
+	unsigned long long journal_generation;
+	in.read(magic, sizeof(magic));
+	in.read((char*)&journal_generation, sizeof(journal_generation));
+	if(!in || memcmp(magic, JOURNAL_MAGIC, sizeof(magic)) != 0 || journal_generation != gen || dbversion != DB_VERSION){
+		in.close();
+		if(!QDir(dbdir.c_str()).remove("journal"))
+			throw ManagerException("could not remove \"" + journalname + "\"");
+		return 0;
+	}
+	length = in.tellg();
 
-	for(unsigned i = 0; i < stream.length(); ++i){
-		const char c = stream.at(i);
+	const unsigned long long journallen = Manager::filesize(journalname);
 
-		if(c == '\n'){
-			line = stream.substr(0, i);
-			stream.erase(0, i + 1);
-			return line;
+	int records = 0;
+	for(;;){
+		unsigned long long sealed;
+		unsigned char iv[crypto::GCM_IV_SIZE];
+		in.read((char*)&sealed, sizeof(sealed));
+		in.read((char*)iv, sizeof(iv));
+		if(!in || sealed > journallen)
+			break;
+
+		std::vector<unsigned char> raw;
+		raw.resize(sealed);
+		in.read((char*)raw.data(), sealed);
+		if(!in)
+			break; // torn write at the end of the journal, everything before it is intact
+
+		std::vector<unsigned char> plaintextdata;
+		try{
+			crypto::unseal(vaultkey, iv, raw, plaintextdata);
+		}catch(const crypto::exception&){
+			break;
+		}
+
+		std::string_view record((char*)plaintextdata.data(), plaintextdata.size());
+		if(record.length() == 0)
+			throw Corrupt();
+		const char op = record[0];
+		record.remove_prefix(1);
+
+		const unsigned long long fields = Password::get_varint(record);
+		Password first;
+		Password second;
+		first.unpack(record, fields, RECORD_FIELDS);
+		if(op == 'e')
+			second.unpack(record, fields, RECORD_FIELDS);
+
+		if(op == 'a'){
+			put(first);
+		}
+		else if(op == 'e'){
+			erase(std::string(first.name()));
+			put(second);
+		}
+		else if(op == 'r'){
+			erase(std::string(first.name()));
 		}
+		else
+			throw Corrupt();
+
+		++records;
+		length = in.tellg();
+	}
+
+	// if it can't be cut off now, Manager::append tries again before it writes
+	if(length != journallen)
+		truncatefile(journalname, length);
+
+	return records;
+}
+
+// add or overwrite
+void Manager::put(const Password &pw){
+	const std::string name(pw.name());
+	const auto it = index.find(name);
+	std::vector<Password> &entries = modify();
+	if(it != index.end()){
+		if(indexed){
+			grams.remove(it->second);
+			grams.add(it->second, searchable(pw));
+		}
+		entries.at(it->second) = pw;
+		return;
+	}
+
+	index[name] = entries.size();
+	if(indexed)
+		grams.add(entries.size(), searchable(pw));
+	entries.push_back(pw);
+	place(entries.size() - 1);
+}
+
+// swap the last entry into the hole so removal doesn't shift the whole vector
+void Manager::erase(const std::string &name){
+	const auto it = index.find(name);
+	if(it == index.end())
+		return;
+
+	std::vector<Password> &entries = modify();
+	const auto position = it->second;
+	index.erase(it);
+	grams.remove(position);
+	unplace(position);
+
+	if(position != entries.size() - 1){
+		grams.move(entries.size() - 1, position);
+		order->move(entries.size() - 1, position, entries);
+		entries.at(position) = std::move(entries.back());
+		index[std::string(entries.at(position).name())] = position;
 	}
 
-	throw Corrupt();
+	entries.pop_back();
+}
+
+void Manager::reindex(){
+	index.clear();
+	index.reserve(entries->size());
+	grams.clear();
+	indexed = false;
+
+	for(std::vector<Password>::size_type i = 0; i < entries->size(); ++i)
+		index[std::string((*entries)[i].name())] = i;
+
+	order->build(by_name(*entries));
+}
+
+// the entry at <position> is new or was renamed, put it in the sorted order
+void Manager::place(std::vector<Password>::size_type position){
+	order->insert(position, *entries);
+}
+
+// take the entry at <position> out of the sorted order, before it's removed or renamed
+void Manager::unplace(std::vector<Password>::size_type position){
+	order->erase(position, *entries);
 }
 
 std::string Manager::real_db_path(const std::string &path){
 	return path + "/db";
 }
 
+std::string Manager::real_journal_path(const std::string &path){
+	return path + "/journal";
+}
+
 std::vector<std::string> Manager::get_backups(const std::string &dir){
 	QDir directory(dir.c_str());
 
@@ -349,13 +2361,116 @@ std::vector<std::string> Manager::get_backups(const std::string &dir){
 
 	auto list = directory.entryList();
 	for(const auto &entry : list){
-		if(entry != "db" && entry != "." && entry != "..")
+		if(entry != "db" && entry != "db.tmp" && entry != "journal" && entry != "." && entry != "..")
 			backups.push_back(entry.toStdString());
 	}
 
 	return backups;
 }
 
+// the day a backup named YYYY_MM_DD.backup or YYYY_MM_DD.N.backup was made, as a julian day, and N in <sequence> (0 for none)
+bool Manager::backup_date(const std::string &name, long long &day, unsigned *sequence){
+	const std::string suffix = ".backup";
+	if(name.length() <= suffix.length() || name.compare(name.length() - suffix.length(), suffix.length(), suffix) != 0)
+		return false;
+
+	int year;
+	int month;
+	int dom;
+	int end = 0;
+	if(3 != sscanf(name.c_str(), "%d_%d_%d%n", &year, &month, &dom, &end))
+		return false;
+
+	const std::string middle = name.substr(end, name.length() - suffix.length() - end);
+	unsigned n = 0;
+	if(!middle.empty()){
+		if(middle.length() < 2 || middle.length() > 6 || middle[0] != '.' || middle.find_first_not_of("0123456789", 1) != std::string::npos)
+			return false;
+		n = std::stoul(middle.substr(1));
+	}
+	if(sequence != NULL)
+		*sequence = n;
+
+	const QDate date(year, month, dom);
+	if(!date.isValid())
+		return false;
+
+	day = date.toJulianDay();
+	return true;
+}
+
+// thin out the backups in <dir>, keeping the newest BACKUPS_DAILY and then the newest of each of the last
+// BACKUPS_WEEKLY weeks and BACKUPS_MONTHLY months, so the folder stays the same size no matter how old the database is
+// runs on the persistence thread once a day, right after that day's backup is made
+// failing to remove a backup isn't worth failing the save over, it'll be tried again tomorrow
+void Manager::prune(const std::string &dir){
+	std::vector<std::pair<long long, std::string>> backups;
+	for(const std::string &e : get_backups(dir)){
+		long long day;
+		if(backup_date(e, day))
+			backups.push_back({day, e});
+	}
+	std::sort(backups.begin(), backups.end(), std::greater<std::pair<long long, std::string>>());
+
+	QDir directory(dir.c_str());
+	std::vector<std::string> kept;
+	unsigned daily = 0;
+	unsigned weekly = 0;
+	unsigned monthly = 0;
+	long long week = -1;
+	long long month = -1;
+	for(const auto &backup : backups){
+		const QDate date = QDate::fromJulianDay(backup.first);
+		bool keep = false;
+
+		if(daily < BACKUPS_DAILY){
+			++daily;
+			keep = true;
+		}
+
+		// julian day 0 was a monday
+		if(backup.first / 7 != week){
+			week = backup.first / 7;
+			if(weekly < BACKUPS_WEEKLY){
+				++weekly;
+				keep = true;
+			}
+		}
+
+		if(date.year() * 12LL + date.month() != month){
+			month = date.year() * 12LL + date.month();
+			if(monthly < BACKUPS_MONTHLY){
+				++monthly;
+				keep = true;
+			}
+		}
+
+		if(keep)
+			kept.push_back(backup.second);
+		else
+			directory.remove(backup.second.c_str());
+	}
+
+	// then the chunks no backup refers to anymore, and whatever an interrupted backup left behind
+	// if a manifest can't be read there's no telling which chunks it needs, so they all stay
+	std::unordered_set<std::string> referenced;
+	for(const std::string &name : kept){
+		Manifest manifest;
+		try{
+			if(load_manifest(dir + "/" + name, manifest))
+				referenced.insert(manifest.chunks.begin(), manifest.chunks.end());
+		}catch(const std::exception&){
+			return;
+		}
+	}
+
+	QDir chunks((dir + "/chunks").c_str());
+	for(const auto &entry : chunks.entryList()){
+		if(entry != "." && entry != ".." && referenced.count(entry.toStdString()) == 0)
+			chunks.remove(entry);
+	}
+}
+
 // get filesize
 long long Manager::filesize(const std::string &fname){
 #ifdef _WIN32
@@ -375,107 +2490,255 @@ long long Manager::filesize(const std::string &fname){
 #endif // _WIN32
 }
 
+Password::Password()
+	:namelen(0)
+	,userlen(0)
+	,slot(0)
+{}
+
 bool Password::operator==(const Password &rhs)const{
-	return nm == rhs.nm && pass == rhs.pass;
+	return name() == rhs.name() && password() == rhs.password();
 }
 
+// case-insensitive, names that differ only in case fall back to a plain comparison so no two names are equivalent
 bool Password::operator<(const Password &rhs)const{
-	return tolower(nm.at(0)) < tolower(rhs.nm.at(0));
+	const std::string_view nm = name();
+	const std::string_view other = rhs.name();
+	const std::string_view::size_type len = std::min(nm.length(), other.length());
+	for(std::string_view::size_type i = 0; i < len; ++i){
+		const int a = tolower((unsigned char)nm[i]);
+		const int b = tolower((unsigned char)other[i]);
+		if(a != b)
+			return a < b;
+	}
+
+	if(nm.length() != other.length())
+		return nm.length() < other.length();
+
+	return nm < other;
 }
 
-std::string Password::name()const{
-	return nm;
+// the views stay valid until the entry is modified
+std::string_view Password::name()const{
+	return std::string_view(fields.data(), namelen);
 }
 
-std::string Password::username()const{
-	return un;
+std::string_view Password::username()const{
+	return std::string_view(fields.data() + namelen, userlen);
 }
 
 std::string Password::password()const{
-	return pass;
+	if(sealed){
+		std::vector<std::string> passwords;
+		try{
+			passwords = sealed->open();
+		}catch(const crypto::exception&){
+			throw Manager::Corrupt();
+		}
+		if(slot >= passwords.size())
+			throw Manager::Corrupt();
+		return passwords[slot];
+	}
+
+	return fields.substr(namelen + userlen);
 }
 
 void Password::set_name(const std::string &n){
-	nm = n;
+	fields.replace(0, namelen, n);
+	namelen = n.length();
 }
 
 void Password::set_username(const std::string &u){
-	un = u;
+	fields.replace(namelen, userlen, u);
+	userlen = u.length();
 }
 
 void Password::set_password(const std::string &p){
-	pass = p;
+	fields.replace(namelen + userlen, std::string::npos, p);
+	sealed.reset();
+}
+
+// append the record, newline included
+void Password::serialize(std::string &out)const{
+	const std::string pass = password();
+	out.reserve(out.length() + fields.length() + pass.length() + 3);
+
+	Password::escape(name(), out);
+	out.push_back(',');
+	Password::escape(username(), out);
+	out.push_back(',');
+	Password::escape(pass, out);
+	out.push_back('\n');
 }
 
-std::string Password::serialize()const{
-	const std::string field_name = Password::escape(nm);
-	const std::string field_pass = Password::escape(pass);
-	const std::string field_usrnm = Password::escape(un);
+// single pass, the fields are unescaped straight into <fields>
+// the newline at the end of the record is optional
+void Password::deserialize(std::string_view line){
+	fields.clear();
+	fields.reserve(line.length());
+	sealed.reset();
+
+	std::string_view::size_type pos = Password::strip(line, fields);
+	namelen = fields.length();
+	userlen = 0;
+	if(pos < line.length() && line[pos] == ','){
+		pos += 1 + Password::strip(line.substr(pos + 1), fields);
+		userlen = fields.length() - namelen;
+	}
+	if(pos < line.length() && line[pos] == ',')
+		Password::strip(line.substr(pos + 1), fields);
+}
 
-	return field_name + "," + field_usrnm + "," + field_pass + "\n";
+// append the record as RECORD_FIELDS length prefixed fields, no escaping
+void Password::pack(std::string &out)const{
+	const std::string pass = password();
+	Password::put_field(out, name());
+	Password::put_field(out, username());
+	Password::put_field(out, pass);
 }
 
-void Password::deserialize(const std::string &line){
-	int field = 0; // current field
-	int start = 0; // starting index of the current field
+// take one record of <count> fields off the front of <in>
+// the first <leading> of them are the leading fields of what pack() writes: INDEX_FIELDS in an index part, RECORD_FIELDS
+// anywhere else. fields past those are ones a later revision added to the part and are skipped, missing ones are left empty
+void Password::unpack(std::string_view &in, unsigned long long count, unsigned leading){
+	std::string_view known[RECORD_FIELDS];
+	for(unsigned long long i = 0; i < count; ++i){
+		const std::string_view field = Password::get_field(in);
+		if(i < leading)
+			known[i] = field;
+	}
 
-	try{
+	fields.clear();
+	fields.reserve(known[0].length() + known[1].length() + known[2].length());
+	fields.append(known[0].data(), known[0].length());
+	fields.append(known[1].data(), known[1].length());
+	fields.append(known[2].data(), known[2].length());
+	namelen = known[0].length();
+	userlen = known[1].length();
+	sealed.reset();
+}
 
-		for(unsigned i = 0; i < line.length(); ++i){
-			const char c = line.at(i);
+Sealed::Sealed(const crypto::secret &k, const unsigned char *initvec, std::vector<unsigned char> &&data, bool deflated)
+	:key(k)
+	,ciphertext(std::move(data))
+	,compressed(deflated)
+{
+	memcpy(iv, initvec, sizeof(iv));
+}
 
-			if(c == '\\'){
-				++i;
-				continue;
-			}
-			else if(c == ',' || c == '\n'){
-				// split
-				switch(field){
-				case 0:
-					nm = Password::strip(line.substr(start, i - start));
-					break;
-				case 1:
-					un = Password::strip(line.substr(start, i - start));
-					break;
-				case 2:
-					pass = Password::strip(line.substr(start, i - start));
-					break;
-				}
+// decrypt all the passwords of the segment
+std::vector<std::string> Sealed::open()const{
+	return Sealed::open(key, iv, ciphertext.data(), ciphertext.size(), compressed);
+}
 
-				++field;
-				start = i + 1;
-			}
-		}
-	}catch(const std::out_of_range &e){
+// same thing for a segment that doesn't have to be kept around
+std::vector<std::string> Sealed::open(const crypto::secret &key, const unsigned char *iv, const unsigned char *ciphertext, unsigned long long length, bool compressed){
+	std::vector<unsigned char> plaintext;
+	if(compressed){
+		std::vector<unsigned char> deflated;
+		crypto::unseal(key, iv, ciphertext, length, deflated);
+		inflate_part(deflated, plaintext);
+	}
+	else
+		crypto::unseal(key, iv, ciphertext, length, plaintext);
+
+	std::vector<std::string> passwords;
+	std::string_view rest((char*)plaintext.data(), plaintext.size());
+	const unsigned long long fields = Password::get_varint(rest);
+	if(fields == 0 && rest.length() > 0)
 		throw Manager::Corrupt();
+
+	while(rest.length() > 0){
+		for(unsigned long long i = 0; i < fields; ++i){
+			const std::string_view field = Password::get_field(rest);
+			if(i == 0)
+				passwords.emplace_back(field);
+		}
 	}
+
+	return passwords;
 }
 
-std::string Password::escape(const std::string &field){
-	std::string escaped = field;
+// append <field> with ',' and '\\' escaped by a backslash
+// room for the worst case is made up front so the loop is just stores
+void Password::escape(std::string_view field, std::string &out){
+	const std::string::size_type base = out.length();
+	out.resize(base + field.length() * 2);
+
+	char *dest = &out[base];
+	for(const char c : field){
+		if(c == ',' || c == '\\')
+			*dest++ = '\\';
+		*dest++ = c;
+	}
+
+	out.resize(dest - out.data());
+}
 
-	for(unsigned i = 0; i < escaped.length(); ++i){
-		const char c = escaped.at(i);
+// append the unescaped field at the start of <record> to <out>
+// returns the position of the ',' or newline that ended it, or the length of <record> if nothing did
+std::string_view::size_type Password::strip(std::string_view record, std::string &out){
+	const std::string::size_type base = out.length();
+	out.resize(base + record.length());
+
+	char *dest = &out[base];
+	std::string_view::size_type i = 0;
+	for(; i < record.length(); ++i){
+		const char c = record[i];
+		if(c == ',' || c == '\n')
+			break;
 
-		if(c == ',' || c == '\\'){
-			escaped.insert(escaped.begin() + i, '\\');
-			++i;
-			continue;
+		if(c == '\\'){
+			// escaped character, taken literally
+			if(++i == record.length())
+				throw Manager::Corrupt();
+			*dest++ = record[i];
 		}
+		else
+			*dest++ = c;
 	}
 
-	return escaped;
+	out.resize(dest - out.data());
+	return i;
 }
 
-// strip escapes
-std::string Password::strip(const std::string &field){
-	std::string stripped = field;
-	for(unsigned i = 0; i < stripped.size(); ++i){
-		if(stripped.at(i) == '\\'){
-			stripped.erase(stripped.begin() + i);
-			continue;
-		}
+// little endian base 128, 7 bits per byte, high bit set on every byte but the last
+void Password::put_varint(std::string &out, unsigned long long value){
+	while(value >= 0x80){
+		out.push_back((char)(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back((char)value);
+}
+
+unsigned long long Password::get_varint(std::string_view &in){
+	unsigned long long value = 0;
+	for(unsigned shift = 0; shift < 64; shift += 7){
+		if(in.length() == 0)
+			throw Manager::Corrupt();
+
+		const unsigned char byte = in[0];
+		in.remove_prefix(1);
+		value |= (unsigned long long)(byte & 0x7f) << shift;
+		if((byte & 0x80) == 0)
+			return value;
 	}
 
-	return stripped;
+	throw Manager::Corrupt();
+}
+
+void Password::put_field(std::string &out, std::string_view field){
+	Password::put_varint(out, field.length());
+	out.append(field.data(), field.length());
+}
+
+// the field is a view into <in>, which is advanced past it
+std::string_view Password::get_field(std::string_view &in){
+	const unsigned long long length = Password::get_varint(in);
+	if(length > in.length())
+		throw Manager::Corrupt();
+
+	const std::string_view field = in.substr(0, length);
+	in.remove_prefix(length);
+	return field;
 }
@@ -3,61 +3,173 @@
 
 #include <exception>
 #include <vector>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <fstream>
 
+#include "crypto.h"
+#include "search.h"
+
+namespace agent{ class client; }
+
+// the passwords of one database segment, left encrypted until somebody asks for one
+class Sealed{
+public:
+	Sealed(const crypto::secret&, const unsigned char*, std::vector<unsigned char>&&, bool);
+	std::vector<std::string> open()const;
+	static std::vector<std::string> open(const crypto::secret&, const unsigned char*, const unsigned char*, unsigned long long, bool);
+
+private:
+	const crypto::secret key;
+	unsigned char iv[crypto::GCM_IV_SIZE];
+	const std::vector<unsigned char> ciphertext;
+	const bool compressed; // deflated before it was sealed
+};
+
 class Password{
 public:
+	Password();
 	bool operator==(const Password&)const;
 	bool operator<(const Password&)const;
-	std::string name()const;
-	std::string username()const;
+	std::string_view name()const;
+	std::string_view username()const;
 	std::string password()const;
 	void set_name(const std::string&);
 	void set_username(const std::string&);
 	void set_password(const std::string&);
-	std::string serialize()const;
-	void deserialize(const std::string&);
+	void serialize(std::string&)const;
+	void deserialize(std::string_view);
+	void pack(std::string&)const;
+	void unpack(std::string_view&, unsigned long long, unsigned);
 
 private:
-	static std::string escape(const std::string&);
-	static std::string strip(const std::string&);
+	friend class Manager;
+	friend class Sealed;
+
+	static void escape(std::string_view, std::string&);
+	static std::string_view::size_type strip(std::string_view, std::string&);
+	static void put_varint(std::string&, unsigned long long);
+	static unsigned long long get_varint(std::string_view&);
+	static void put_field(std::string&, std::string_view);
+	static std::string_view get_field(std::string_view&);
 
-	std::string nm; // service name
-	std::string un; // user name
-	std::string pass;
+	std::string fields; // service name, user name and password back to back, one allocation (or none, if it's short) per entry
+	unsigned namelen;
+	unsigned userlen;
+	std::shared_ptr<const Sealed> sealed; // set while the password hasn't been decrypted yet, it's password number <slot> of the segment
+	unsigned slot;
 };
 
 class Manager{
 public:
 	Manager(const std::string&);
 	Manager(const Manager&) = delete;
-	void open(const std::string&);
+	~Manager();
+	void open(const std::string&, bool = false);
+	bool attach();
 	const std::vector<Password> &get()const;
 	void add(const Password&);
 	const Password &find(const std::string&)const;
+	std::vector<std::vector<Password>::size_type> sorted()const;
+	std::vector<Password>::size_type sorted(std::vector<Password>::size_type)const;
+	std::vector<std::vector<Password>::size_type> fuzzy(const std::string&, unsigned)const;
+	std::vector<std::string> backups()const;
+	std::vector<Password> restore(int, int, int)const;
+	std::vector<Password> restore(const std::string&)const;
+	void replace(std::vector<Password>&&);
+	void diff(const std::string&, const std::string&, const std::function<void(const Password*, const Password*)>&)const;
 	void edit(const std::string&, const std::string&, const std::string&, const std::string&);
 	void remove(const std::string&);
-	void master(const std::string&);
-	std::string get_master()const;
+	void master(const std::string&, const std::string&);
+	void master(const std::string&, const std::string&, const crypto::secret&);
+	static crypto::secret derive_key(const std::string&);
 	std::string gen_memorable();
 	static std::string gen_random();
 	static void generate(const std::string&, const std::string &master);
+	static std::string default_path();
+	void flush();
+	void on_save(const std::function<void(bool, const std::string&)>&);
 
 private:
-	void save()const;
-	void write(const std::string&)const;
+	class Reader;
+	class Unsealer;
+	class Order;
+
+	// work waiting for the persistence thread
+	struct job{
+		std::shared_ptr<const std::vector<Password>> snapshot; // full save, supersedes any records queued before it
+		std::shared_ptr<const std::vector<Password>> backup; // the entries before the day's first change, see Manager::pin()
+		std::vector<std::shared_ptr<const std::vector<Password>>> replaced; // entries replace() swapped out once the day had its backup
+		std::vector<std::string> records; // journal records queued after <snapshot>
+		crypto::secret key;
+		unsigned compression; // of <snapshot>
+	};
+
+	void persist();
+	void snapshot();
+	std::vector<Password> &modify();
+	void pin();
+	void save(const std::vector<Password>&, const std::vector<Password>&, const std::vector<std::shared_ptr<const std::vector<Password>>>&, const crypto::secret&, unsigned, long long, unsigned long long&, unsigned long long&);
+	void log(char, const Password&, const Password* = NULL);
+	void append(const std::vector<std::string>&, const crypto::secret&, unsigned long long, unsigned long long&);
+	static void write(const std::string&, const std::vector<Password>&, const crypto::secret&, unsigned, unsigned long long);
+	static void write_backup(const std::string&, const std::string&, const std::vector<Password>&, const crypto::secret&);
+	static std::vector<Password> read_backup(const std::string&, const std::string&, const std::string&);
 	std::string getword();
-	static std::vector<Password> read(const std::string&, const std::string&);
-	static std::string getline(std::string&);
+	static std::vector<Password> read(const std::string&, const std::string&, crypto::secret&, unsigned&, unsigned&, unsigned long long&, bool);
+	static std::vector<Password> read_segments(const std::string&, long long, const crypto::secret&, unsigned, bool);
+	static void unpack(std::string_view, std::vector<Password>&);
+	int replay(unsigned long long, unsigned long long&);
+	void put(const Password&);
+	void erase(const std::string&);
+	void reindex();
+	void place(std::vector<Password>::size_type);
+	void unplace(std::vector<Password>::size_type);
 	static std::string real_db_path(const std::string&);
+	static std::string real_journal_path(const std::string&);
 	static std::vector<std::string> get_backups(const std::string&);
+	static bool backup_date(const std::string&, long long&, unsigned* = NULL);
+	static void prune(const std::string&);
 	static long long filesize(const std::string&);
 
 	const std::string dbname;
 	const std::string dbdir;
+	const std::string journalname;
 	std::string masterp;
-	std::vector<Password> entries;
+	crypto::secret vaultkey; // derived from <masterp> once at open() and reused for every save, set under <lock>
+	unsigned dbversion; // format of the database on disk, DB_VERSION or 0 for a legacy one that's rewritten at open(), set under <lock>
+	unsigned compression; // how the database parts are compressed before they're sealed, set under <lock> and passed to saves in their job
+	int journal_records; // number of change records appended to the journal since the last compaction
+	long long last_backup; // julian day of the newest backup, set by the persistence thread under <lock> once it's running
+	long long pinned; // julian day the entries were last held on to for a backup, under <lock>
+	unsigned long long generation; // of the database on disk, picked at random for every full save, under <lock>
+	unsigned long long journal_length; // bytes of the journal up to the end of its last good record, 0 if there's none, under <lock>
+	std::shared_ptr<std::vector<Password>> entries; // shared with the persistence thread while it saves a snapshot
+	std::unordered_map<std::string, std::vector<Password>::size_type> index; // name -> position in entries
+	mutable search::trigrams grams; // names and usernames -> position in entries, once <indexed>
+	mutable bool indexed; // <grams> has been built, it's left until the first fuzzy()
+	std::unique_ptr<Order> order; // positions in entries, sorted by name
 	std::ifstream words;
+	std::unique_ptr<agent::client> remote; // set by attach(), the agent owns the database then and changes go through it
+	mutable Password fetched; // the last entry find() got from the agent, with its password
+
+	job pending;
+	bool busy; // persistence thread is writing
+	bool stopping;
+	bool unsaved; // a write failed since the last full save, so the disk may be missing changes
+	std::string error; // last failure of the persistence thread
+	std::function<void(bool, const std::string&)> callback;
+	std::mutex lock; // guards everything shared with the persistence thread
+	std::mutex callback_lock;
+	std::condition_variable cv;
+	std::condition_variable idle;
+	std::thread worker;
 
 public:
 	class IncorrectPassword:public std::exception{
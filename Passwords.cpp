@@ -1,14 +1,34 @@
-#include <cctype>
 #include <algorithm>
 
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QPushButton>
 #include <QMessageBox>
+#include <QCoreApplication>
+#include <QEvent>
 
 #include "Passwords.h"
 #include "Dialog.h"
 
+#define SEARCH_DELAY 100 // milliseconds of typing inactivity before searching
+#define FUZZY_LIMIT 50 // most similar entries listed after the exact matches
+
+// carries the result of a background save from the persistence thread to the gui thread
+class SaveEvent:public QEvent{
+public:
+	SaveEvent(bool s, const std::string &msg)
+		:QEvent(SaveEvent::type())
+		,success(s)
+		,message(msg){}
+
+	static QEvent::Type type(){
+		static const QEvent::Type t = (QEvent::Type)QEvent::registerEventType();
+		return t;
+	}
+
+	const bool success;
+	const std::string message;
+};
 
 Passwords::Passwords(Manager &mgr)
 	:manager(mgr)
@@ -19,26 +39,39 @@ Passwords::Passwords(Manager &mgr)
 	auto vbox = new QVBoxLayout;
 	setLayout(vbox);
 
-	list = new QListWidget;
-	auto searchbar = new QLineEdit;
+	model = new PasswordModel(manager, this);
+	list = new QListView;
+	list->setModel(model);
+	list->setUniformItemSizes(true);
+	list->setEditTriggers(QAbstractItemView::NoEditTriggers);
+	searchbar = new QLineEdit;
+	typing = new QTimer(this);
+	typing->setSingleShot(true);
+	typing->setInterval(SEARCH_DELAY);
 	auto add = new QPushButton("Add Password");
 	auto settings = new QPushButton("Settings");
 
 	QObject::connect(add, &QPushButton::clicked, this, &Passwords::add);
-	QObject::connect(list, &QListWidget::itemDoubleClicked, this, &Passwords::view);
-	QObject::connect(searchbar, &QLineEdit::textChanged, [this](const QString &text){
-		refresh(text.toStdString());
+	QObject::connect(list, &QListView::doubleClicked, this, &Passwords::view);
+	QObject::connect(searchbar, &QLineEdit::textChanged, [this]{
+		typing->start();
+	});
+	QObject::connect(typing, &QTimer::timeout, [this]{
+		model->filter(searchbar->text().toStdString());
 	});
 	QObject::connect(settings, &QPushButton::clicked, [this]{
-		Settings::config pre;
-		pre.master = manager.get_master();
-
-		Settings settings(pre);
+		Settings settings;
 		if(settings.exec()){
 			Settings::config config = settings.get_config();
 			// apply the settings
-			if(pre.master != config.master){
-				manager.master(config.master);
+			if(config.current != config.master){
+				try{
+					manager.master(config.current, config.master);
+				}catch(const Manager::IncorrectPassword&){
+					QMessageBox::critical(this, "Error", "Incorrect current master password!");
+				}catch(const Manager::ManagerException &e){
+					QMessageBox::critical(this, "Error", e.what());
+				}
 			}
 		}
 	});
@@ -48,9 +81,26 @@ Passwords::Passwords(Manager &mgr)
 	vbox->addWidget(add);
 	vbox->addWidget(settings);
 
+	manager.on_save([this](bool success, const std::string &message){
+		QCoreApplication::postEvent(this, new SaveEvent(success, message));
+	});
+
 	refresh();
 }
 
+Passwords::~Passwords(){
+	manager.on_save(NULL);
+}
+
+void Passwords::customEvent(QEvent *event){
+	if(event->type() != SaveEvent::type())
+		return;
+
+	const SaveEvent *save = static_cast<const SaveEvent*>(event);
+	if(!save->success)
+		QMessageBox::critical(this, "Database Error", ("Could not save the database:\n" + save->message).c_str());
+}
+
 void Passwords::add(){
 	AddPassword newpass(manager, NULL, NULL, NULL);
 	if(newpass.exec()){
@@ -66,42 +116,97 @@ void Passwords::add(){
 	refresh();
 }
 
-void Passwords::view(const QListWidgetItem *item){
-	const Password &passwd = manager.find(item->text().toStdString());
-	ViewPassword vp(passwd, *this, manager);
-	vp.exec();
+void Passwords::view(const QModelIndex &index){
+	const Password &passwd = manager.find(model->name(index));
+	try{
+		ViewPassword vp(passwd, *this, manager);
+		vp.exec();
+	}catch(const Manager::Corrupt&){
+		QMessageBox::critical(this, "Database Error", "The password could not be decrypted, the database appears to be corrupt.");
+	}
 }
 
-// refresh the list of passwords on the screen according to a string filter
-void Passwords::refresh(const std::string &filter){
-	list->clear();
+// refresh the list of passwords on the screen after the entries in the manager change
+void Passwords::refresh(){
+	model->reload();
+	model->filter(searchbar->text().toStdString());
+}
 
-	std::vector<Password> *all = NULL;
+PasswordModel::PasswordModel(const Manager &mgr, QObject *parent)
+	:QAbstractListModel(parent)
+	,manager(mgr)
+{}
+
+// entries changed, rebuild the folded names in display order, the manager keeps that order up to date already
+void PasswordModel::reload(){
+	beginResetModel();
+
+	const std::vector<Password> &entries = manager.get();
+	const std::vector<std::vector<Password>::size_type> order = manager.sorted();
+	std::string::size_type bytes = 0;
+	for(const Password &pw : entries)
+		bytes += pw.name().length();
+
+	names.clear();
+	names.reserve(entries.size(), bytes);
+	slots.resize(entries.size());
+	for(std::vector<Password>::size_type slot = 0; slot < order.size(); ++slot){
+		names.push(entries[order[slot]].name());
+		slots[order[slot]] = slot;
+	}
 
-	std::vector<Password> entries = manager.get();
-	std::vector<Password> sorted;
-	if(filter.length() > 0){
-		all = &sorted;
-		for(const Password &pw : entries){
-			if(Passwords::to_lower(pw.name()).find(Passwords::to_lower(filter)) != std::string::npos){
-				sorted.push_back(pw);
-			}
-		}
+	names.match("", rows);
+	similar.clear();
+	current.clear();
+
+	endResetModel();
+}
+
+// when the new filter contains the previous one, only the previous matches can possibly match, so just narrow those down
+void PasswordModel::filter(const std::string &filter){
+	const std::string lower = search::fold(filter);
+	if(lower == current)
+		return;
+
+	beginResetModel();
+
+	if(lower.find(current) != std::string::npos){
+		rows.erase(std::remove_if(rows.begin(), rows.end(), [this, &lower](std::vector<Password>::size_type i){
+			return !names.contains(i, lower);
+		}), rows.end());
 	}
 	else
-		all = &entries;
+		names.match(lower, rows);
+
+	// typos and usernames
+	similar.clear();
+	if(lower.length() > 0){
+		for(const std::vector<Password>::size_type i : manager.fuzzy(lower, FUZZY_LIMIT)){
+			if(!names.contains(slots[i], lower))
+				similar.push_back(i);
+		}
+	}
 
-	std::sort(all->begin(), all->end());
+	current = lower;
 
-	for(const Password &entry : *all)
-		list->addItem(entry.name().c_str());
+	endResetModel();
 }
 
-std::string Passwords::to_lower(const std::string &str){
-	std::string lower(str);
+std::string PasswordModel::name(const QModelIndex &index)const{
+	const std::vector<Password>::size_type row = index.row();
+	if(row < rows.size())
+		return std::string(manager.get().at(manager.sorted(rows.at(row))).name());
+
+	return std::string(manager.get().at(similar.at(row - rows.size())).name());
+}
+
+int PasswordModel::rowCount(const QModelIndex &parent)const{
+	return parent.isValid() ? 0 : rows.size() + similar.size();
+}
 
-	for(char &c : lower)
-		c = tolower(c);
+QVariant PasswordModel::data(const QModelIndex &index, int role)const{
+	if(!index.isValid() || role != Qt::DisplayRole)
+		return QVariant();
 
-	return lower;
+	return QString::fromStdString(name(index));
 }
@@ -2,22 +2,53 @@
 #define PASSWORDS_H
 
 #include <QWidget>
-#include <QListWidget>
+#include <QListView>
+#include <QAbstractListModel>
+#include <QTimer>
+#include <QLineEdit>
 
 #include "Manager.h"
+#include "search.h"
+
+// names of the entries that match the search, straight out of the manager's storage
+// entries whose name contains the search come first, then the ones that only look similar to it
+// the view only asks for the rows that are actually on screen
+class PasswordModel:public QAbstractListModel{
+public:
+	PasswordModel(const Manager&, QObject*);
+	void reload();
+	void filter(const std::string&);
+	std::string name(const QModelIndex&)const;
+	virtual int rowCount(const QModelIndex& = QModelIndex())const;
+	virtual QVariant data(const QModelIndex&, int = Qt::DisplayRole)const;
+
+private:
+	const Manager &manager;
+	search::arena names; // folded names, in the order of manager.sorted()
+	std::vector<std::vector<Password>::size_type> slots; // slot in <names> of every position in manager.get()
+	std::vector<std::vector<Password>::size_type> rows; // slots in <names> that match <current>, ascending
+	std::vector<std::vector<Password>::size_type> similar; // positions in manager.get() of the fuzzy matches not in <rows>, best first
+	std::string current; // folded filter that produced <rows>
+};
 
 class Passwords:public QWidget{
 public:
 	Passwords(Manager&);
 	Passwords(const Passwords&) = delete;
-	void refresh(const std::string& = "");
+	~Passwords();
+	void refresh();
+
+protected:
+	virtual void customEvent(QEvent*);
 
 private:
 	void add();
-	void view(const QListWidgetItem*);
-	static std::string to_lower(const std::string&);
+	void view(const QModelIndex&);
 
-	QListWidget *list;
+	QListView *list;
+	QLineEdit *searchbar;
+	QTimer *typing; // restarted on every keystroke, so only the last one of a burst is searched for
+	PasswordModel *model;
 
 	Manager &manager;
 };
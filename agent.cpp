@@ -0,0 +1,607 @@
+#include <chrono>
+#include <unordered_map>
+
+#include <string.h>
+
+#include "agent.h"
+
+#define MAX_REQUEST (16 * 1024 * 1024) // a client sending more than this is dropped
+#define MAX_REPLY (1024 * 1024 * 1024)
+#define MAX_EVENTS 64
+#define READ_SIZE 65536
+
+// the socket lives next to the database, whose folder only its owner can get into
+std::string agent::path(const std::string &dir){
+	return dir + "/agent";
+}
+
+static void put_varint(std::string &out, unsigned long long value){
+	while(value >= 0x80){
+		out.push_back((char)(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back((char)value);
+}
+
+// [length][code][fields...]
+static void frame(std::string &out, char code, const std::vector<std::string_view> &fields){
+	const std::string::size_type start = out.length();
+	out.append(4, 0);
+	out.push_back(code);
+	for(const std::string_view field : fields){
+		put_varint(out, field.length());
+		out.append(field.data(), field.length());
+	}
+
+	const unsigned length = out.length() - start - 4;
+	for(int i = 0; i < 4; ++i)
+		out[start + i] = (char)(length >> (i * 8));
+}
+
+static unsigned frame_length(const char *data){
+	unsigned length = 0;
+	for(int i = 0; i < 4; ++i)
+		length |= (unsigned)(unsigned char)data[i] << (i * 8);
+	return length;
+}
+
+// split a message body after its code into fields, false if it's malformed
+static bool fields(std::string_view body, std::vector<std::string_view> &out){
+	out.clear();
+	while(body.length() > 0){
+		unsigned long long length = 0;
+		unsigned shift = 0;
+		for(;;){
+			if(body.length() == 0 || shift >= 64)
+				return false;
+
+			const unsigned char byte = body[0];
+			body.remove_prefix(1);
+			length |= (unsigned long long)(byte & 0x7f) << shift;
+			shift += 7;
+			if((byte & 0x80) == 0)
+				break;
+		}
+		if(length > body.length())
+			return false;
+
+		out.push_back(body.substr(0, length));
+		body.remove_prefix(length);
+	}
+
+	return true;
+}
+
+#ifdef _WIN32
+agent::server::server(Manager &m, const std::string &n, unsigned i)
+	:mgr(m)
+	,name(n)
+	,idle(i)
+	,listener(-1)
+	,poll(-1)
+	,signals(-1)
+	,wakeup(-1)
+	,stopping(false)
+{
+	throw Manager::ManagerException("The agent needs unix domain sockets, it isn't available on Windows");
+}
+agent::server::~server(){}
+void agent::server::run(){}
+void agent::server::work(){}
+
+// there's never an agent to talk to
+agent::client::client(const std::string&)
+	:fd(-1)
+{
+	throw Manager::NotFound();
+}
+agent::client::~client(){}
+std::vector<std::string> agent::client::call(char, const std::vector<std::string_view>&){
+	throw Manager::NotFound();
+}
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+
+// a client connection and whatever has been read from it or is waiting to be written to it
+struct Connection{
+	unsigned long long id;
+	std::string in;
+	std::string out;
+	bool writing; // waiting for the socket to take the rest of <out>
+	bool waiting; // a request of it is with the worker, the ones after it wait so the replies stay in order
+};
+
+static bool address(const std::string &name, sockaddr_un &addr){
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(name.length() >= sizeof(addr.sun_path))
+		return false;
+
+	memcpy(addr.sun_path, name.c_str(), name.length() + 1);
+	return true;
+}
+
+// answer one request into <out>, <stop> is set for a STOP request. MASTER and FLUSH go to the worker instead, see server::run()
+static void answer(Manager &mgr, char op, const std::vector<std::string_view> &args, std::string &out, bool &stop){
+	try{
+		if(op == agent::GET && args.size() == 1){
+			const Password &pw = mgr.find(std::string(args[0]));
+			const std::string pass = pw.password();
+			frame(out, agent::OK, {pw.name(), pw.username(), pass});
+		}
+		else if(op == agent::ADD && args.size() == 3){
+			Password pw;
+			pw.set_name(std::string(args[0]));
+			pw.set_username(std::string(args[1]));
+			pw.set_password(std::string(args[2]));
+			mgr.add(pw);
+			frame(out, agent::OK, {});
+		}
+		else if(op == agent::EDIT && args.size() == 4){
+			mgr.edit(std::string(args[0]), std::string(args[1]), std::string(args[2]), std::string(args[3]));
+			frame(out, agent::OK, {});
+		}
+		else if(op == agent::REMOVE && args.size() == 1){
+			mgr.remove(std::string(args[0]));
+			frame(out, agent::OK, {});
+		}
+		else if(op == agent::SNAPSHOT && args.size() == 0){
+			const std::vector<Password> &entries = mgr.get();
+			std::vector<std::string_view> reply;
+			reply.reserve(entries.size() * 2);
+			for(const Password &pw : entries){
+				reply.push_back(pw.name());
+				reply.push_back(pw.username());
+			}
+			frame(out, agent::OK, reply);
+		}
+		else if(op == agent::STOP && args.size() == 0){
+			mgr.flush();
+			frame(out, agent::OK, {});
+			stop = true;
+		}
+		else
+			frame(out, agent::FAILED, {"malformed request"});
+	}catch(const std::exception &e){
+		frame(out, agent::FAILED, {e.what()});
+	}
+}
+
+// listen on <n> for requests against <m>, which has to be open already
+agent::server::server(Manager &m, const std::string &n, unsigned i)
+	:mgr(m)
+	,name(n)
+	,idle(i)
+	,listener(-1)
+	,poll(-1)
+	,signals(-1)
+	,wakeup(-1)
+	,stopping(false)
+{
+	sockaddr_un addr;
+	if(!address(name, addr))
+		throw Manager::ManagerException("The path of the agent socket \"" + name + "\" is too long");
+
+	// a socket that still answers belongs to a running agent, one that doesn't was left behind by an agent that didn't exit cleanly
+	const int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	const bool running = probe != -1 && connect(probe, (sockaddr*)&addr, sizeof(addr)) == 0;
+	if(probe != -1)
+		close(probe);
+	if(running)
+		throw Manager::ManagerException("An agent is already running on \"" + name + "\"");
+	unlink(name.c_str());
+
+	listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(listener == -1)
+		throw Manager::ManagerException("Could not create the agent socket");
+
+	// nobody else gets to connect, even if the folder's permissions are loosened
+	const mode_t mask = umask(S_IRWXG | S_IRWXO);
+	const bool bound = bind(listener, (sockaddr*)&addr, sizeof(addr)) == 0;
+	umask(mask);
+	if(!bound || listen(listener, SOMAXCONN) != 0){
+		close(listener);
+		throw Manager::ManagerException("Could not listen on \"" + name + "\"");
+	}
+
+	// SIGTERM, SIGINT and SIGHUP end the loop like an idle timeout does, so the database is flushed on the way out
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	signals = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+
+	wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	poll = epoll_create1(EPOLL_CLOEXEC);
+	epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = listener;
+	bool watching = poll != -1 && epoll_ctl(poll, EPOLL_CTL_ADD, listener, &ev) == 0;
+	ev.data.fd = signals;
+	watching = watching && signals != -1 && epoll_ctl(poll, EPOLL_CTL_ADD, signals, &ev) == 0;
+	ev.data.fd = wakeup;
+	if(!watching || wakeup == -1 || epoll_ctl(poll, EPOLL_CTL_ADD, wakeup, &ev) != 0){
+		if(poll != -1)
+			close(poll);
+		if(signals != -1)
+			close(signals);
+		if(wakeup != -1)
+			close(wakeup);
+		close(listener);
+		unlink(name.c_str());
+		throw Manager::ManagerException("Could not set up the agent's event loop");
+	}
+
+	worker = std::thread(&agent::server::work, this);
+}
+
+// a task the worker is still on is finished first, what its client is owed is dropped
+agent::server::~server(){
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+		queued.clear();
+	}
+	cv.notify_one();
+	worker.join();
+
+	if(poll != -1)
+		close(poll);
+	if(signals != -1)
+		close(signals);
+	if(wakeup != -1)
+		close(wakeup);
+	if(listener != -1){
+		close(listener);
+		unlink(name.c_str());
+	}
+}
+
+// one thread, level triggered: read whatever a client sent, answer every whole request in it, write back as much as the socket takes
+// MASTER spends about a second deriving the new key and FLUSH waits for the disk, so those go to the worker thread and are
+// answered when it signals <wakeup>, the loop keeps serving every other client meanwhile
+void agent::server::run(){
+	std::unordered_map<int, Connection> connections;
+	std::vector<std::string_view> args;
+	std::vector<char> buffer(READ_SIZE);
+	epoll_event events[MAX_EVENTS];
+	auto last = std::chrono::steady_clock::now(); // when the last client went away, or the agent started
+	unsigned long long accepted = 0;
+	bool stop = false;
+
+	const auto watch = [this](int fd, unsigned what, int how){
+		epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = what;
+		ev.data.fd = fd;
+		return epoll_ctl(poll, how, fd, &ev) == 0;
+	};
+
+	// answer the whole requests <conn> has sent, up to one for the worker, and send what the socket takes, false to close it
+	const auto serve = [&](int fd, Connection &conn, bool open){
+		std::string::size_type consumed = 0;
+		while(!conn.waiting && conn.in.length() - consumed >= 4){
+			const unsigned length = frame_length(conn.in.data() + consumed);
+			if(length == 0 || length > MAX_REQUEST){
+				open = false;
+				break;
+			}
+			if(conn.in.length() - consumed - 4 < length)
+				break;
+
+			const std::string_view body(conn.in.data() + consumed + 4, length);
+			consumed += 4 + length;
+			if(!fields(body.substr(1), args))
+				frame(conn.out, FAILED, {"malformed request"});
+			else if((body[0] == MASTER && args.size() == 2) || (body[0] == FLUSH && args.size() == 0)){
+				{
+					std::lock_guard<std::mutex> guard(lock);
+					queued.push_back(task{fd, conn.id, body[0], std::vector<std::string>(args.begin(), args.end()), crypto::secret(), std::string()});
+				}
+				cv.notify_one();
+				conn.waiting = true;
+			}
+			else
+				answer(mgr, body[0], args, conn.out, stop);
+		}
+		conn.in.erase(0, consumed);
+
+		// a client that hung up after sending its last request still gets the answers it's owed, if it's listening
+		std::string::size_type sent = 0;
+		while(sent < conn.out.length()){
+			const ssize_t put = send(fd, conn.out.data() + sent, conn.out.length() - sent, MSG_NOSIGNAL);
+			if(put > 0)
+				sent += put;
+			else if(put == -1 && errno == EINTR)
+				continue;
+			else{
+				if(put == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+					open = false;
+				break;
+			}
+		}
+		conn.out.erase(0, sent);
+
+		if(open && conn.out.empty() != !conn.writing){
+			conn.writing = !conn.out.empty();
+			open = watch(fd, conn.writing ? EPOLLIN | EPOLLOUT : EPOLLIN, EPOLL_CTL_MOD);
+		}
+
+		return open;
+	};
+
+	const auto drop = [&](std::unordered_map<int, Connection>::iterator it){
+		epoll_ctl(poll, EPOLL_CTL_DEL, it->first, NULL);
+		close(it->first);
+		connections.erase(it);
+		if(connections.empty())
+			last = std::chrono::steady_clock::now();
+	};
+
+	// the idle time only runs while nobody is connected, a gui that's open but quiet keeps the agent around
+	while(!stop){
+		int timeout = -1;
+		if(idle > 0 && connections.empty()){
+			const long long elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - last).count();
+			if(elapsed >= idle * 1000LL)
+				break;
+			timeout = idle * 1000LL - elapsed;
+		}
+
+		const int ready = epoll_wait(poll, events, MAX_EVENTS, timeout);
+		if(ready == -1 && errno != EINTR)
+			break;
+
+		for(int i = 0; i < ready && !stop; ++i){
+			const int fd = events[i].data.fd;
+
+			if(fd == signals){
+				stop = true;
+				break;
+			}
+
+			if(fd == listener){
+				for(;;){
+					const int conn = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+					if(conn == -1)
+						break;
+
+					ucred peer;
+					socklen_t len = sizeof(peer);
+					if(getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &peer, &len) != 0 || peer.uid != getuid() || !watch(conn, EPOLLIN, EPOLL_CTL_ADD)){
+						close(conn);
+						continue;
+					}
+					connections[conn] = Connection{++accepted, std::string(), std::string(), false, false};
+				}
+				continue;
+			}
+
+			// the worker's answers, a new master password is only applied here, Manager isn't shared with the worker
+			// it still is if its client has gone, like it would have been had the client hung up just after asking
+			if(fd == wakeup){
+				unsigned long long signalled;
+				while(read(wakeup, &signalled, sizeof(signalled)) == -1 && errno == EINTR);
+
+				std::vector<task> finished;
+				{
+					std::lock_guard<std::mutex> guard(lock);
+					finished.swap(done);
+				}
+
+				for(task &t : finished){
+					if(t.op == MASTER && t.out.empty()){
+						try{
+							mgr.master(t.args[0], t.args[1], t.key);
+							frame(t.out, OK, {});
+						}catch(const std::exception &e){
+							frame(t.out, FAILED, {e.what()});
+						}
+					}
+
+					const auto it = connections.find(t.fd);
+					if(it == connections.end() || it->second.id != t.connection)
+						continue;
+
+					it->second.out += t.out;
+					it->second.waiting = false;
+					if(!serve(t.fd, it->second, true))
+						drop(it);
+				}
+				continue;
+			}
+
+			const auto it = connections.find(fd);
+			if(it == connections.end())
+				continue;
+			Connection &conn = it->second;
+			bool open = true;
+
+			if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)){
+				for(;;){
+					const ssize_t got = read(fd, buffer.data(), buffer.size());
+					if(got > 0){
+						conn.in.append(buffer.data(), got);
+						continue;
+					}
+					if(got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+						open = false;
+					if(got == -1 && errno == EINTR)
+						continue;
+					break;
+				}
+			}
+
+			// one that hangs up while the worker has its request doesn't get the reply, the id tells it from the next one on <fd>
+			if(!serve(fd, conn, open))
+				drop(it);
+		}
+	}
+
+	for(const auto &conn : connections)
+		close(conn.first);
+}
+
+// the slow requests, one at a time. MASTER only derives the key here and leaves the rest to the loop
+void agent::server::work(){
+	std::unique_lock<std::mutex> guard(lock);
+
+	for(;;){
+		cv.wait(guard, [this]{
+			return stopping || !queued.empty();
+		});
+		if(queued.empty())
+			return;
+
+		task t = std::move(queued.front());
+		queued.pop_front();
+		guard.unlock();
+
+		try{
+			if(t.op == MASTER)
+				t.key = Manager::derive_key(t.args[1]);
+			else{
+				mgr.flush();
+				frame(t.out, OK, {});
+			}
+		}catch(const std::exception &e){
+			frame(t.out, FAILED, {e.what()});
+		}
+
+		guard.lock();
+		done.push_back(std::move(t));
+		const unsigned long long one = 1;
+		while(write(wakeup, &one, sizeof(one)) == -1 && errno == EINTR);
+	}
+}
+
+// connect to the agent listening on <name>, NotFound if there isn't one
+agent::client::client(const std::string &name)
+	:fd(-1)
+{
+	sockaddr_un addr;
+	if(!address(name, addr))
+		throw Manager::NotFound();
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd == -1)
+		throw Manager::NotFound();
+	if(connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0){
+		close(fd);
+		throw Manager::NotFound();
+	}
+}
+
+agent::client::~client(){
+	close(fd);
+}
+
+// send one request and wait for its reply, a FAILED reply is thrown as a ManagerException with the agent's message
+std::vector<std::string> agent::client::call(char op, const std::vector<std::string_view> &args){
+	std::string message;
+	frame(message, op, args);
+
+	std::string::size_type sent = 0;
+	while(sent < message.length()){
+		const ssize_t put = send(fd, message.data() + sent, message.length() - sent, MSG_NOSIGNAL);
+		if(put == -1 && errno == EINTR)
+			continue;
+		if(put <= 0)
+			throw Manager::ManagerException("Lost the connection to the agent");
+		sent += put;
+	}
+
+	const auto receive = [this](char *data, std::string::size_type length){
+		std::string::size_type got = 0;
+		while(got < length){
+			const ssize_t n = read(fd, data + got, length - got);
+			if(n == -1 && errno == EINTR)
+				continue;
+			if(n <= 0)
+				throw Manager::ManagerException("Lost the connection to the agent");
+			got += n;
+		}
+	};
+
+	char header[4];
+	receive(header, sizeof(header));
+	const unsigned length = frame_length(header);
+	if(length == 0 || length > MAX_REPLY)
+		throw Manager::ManagerException("The agent sent a malformed reply");
+
+	message.resize(length);
+	receive(&message[0], length);
+
+	std::vector<std::string_view> views;
+	if(!fields(std::string_view(message).substr(1), views))
+		throw Manager::ManagerException("The agent sent a malformed reply");
+	if(message[0] != OK)
+		throw Manager::ManagerException(views.size() > 0 ? std::string(views[0]) : "The agent could not do that");
+
+	return std::vector<std::string>(views.begin(), views.end());
+}
+#endif // _WIN32
+
+Password agent::client::find(const std::string &name){
+	const std::vector<std::string> reply = call(GET, {name});
+	if(reply.size() != 3)
+		throw Manager::ManagerException("The agent sent a malformed reply");
+
+	Password pw;
+	pw.set_name(reply[0]);
+	pw.set_username(reply[1]);
+	pw.set_password(reply[2]);
+	return pw;
+}
+
+void agent::client::add(const Password &pw){
+	const std::string pass = pw.password();
+	call(ADD, {pw.name(), pw.username(), pass});
+}
+
+void agent::client::edit(const std::string &name, const std::string &newname, const std::string &newuser, const std::string &newpass){
+	call(EDIT, {name, newname, newuser, newpass});
+}
+
+void agent::client::remove(const std::string &name){
+	call(REMOVE, {name});
+}
+
+void agent::client::master(const std::string &current, const std::string &mp){
+	call(MASTER, {current, mp});
+}
+
+void agent::client::flush(){
+	call(FLUSH, {});
+}
+
+// every entry the agent has, without the passwords, find() gets those
+void agent::client::snapshot(std::vector<Password> &entries){
+	const std::vector<std::string> reply = call(SNAPSHOT, {});
+	if(reply.size() % 2 != 0)
+		throw Manager::ManagerException("The agent sent a malformed reply");
+
+	entries.clear();
+	entries.reserve(reply.size() / 2);
+	for(std::vector<std::string>::size_type i = 0; i < reply.size(); i += 2){
+		entries.emplace_back();
+		entries.back().set_name(reply[i]);
+		entries.back().set_username(reply[i + 1]);
+	}
+}
+
+void agent::client::stop(){
+	call(STOP, {});
+}
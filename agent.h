@@ -0,0 +1,86 @@
+#ifndef AGENT_H
+#define AGENT_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+
+#include "Manager.h"
+
+// a process that keeps the database unlocked and answers requests from the same user over a unix socket, like ssh-agent
+// while it runs it's the only one writing the database, the gui and passwords-cli send their changes through it
+// every message is [body length, 4 bytes little endian][body], a request body is [op][fields...] and a reply body is
+// [status][fields...], each field is [varint length][bytes] the way database records are packed
+namespace agent{
+	const char GET = 'g'; // name -> name, user name, password
+	const char ADD = 'a'; // name, user name, password
+	const char EDIT = 'e'; // name, new name, new user name, new password
+	const char REMOVE = 'r'; // name
+	const char MASTER = 'm'; // current master password, new master password
+	const char FLUSH = 'f'; // wait until every change so far is on the disk
+	const char SNAPSHOT = 's'; // -> name and user name of every entry, passwords are asked for one at a time with GET
+	const char STOP = 'q'; // flush and exit
+
+	const char OK = 0;
+	const char FAILED = 1; // -> message
+
+	std::string path(const std::string&);
+
+	class server{
+	public:
+		server(Manager&, const std::string&, unsigned);
+		server(const server&) = delete;
+		~server();
+		void run();
+
+	private:
+		// a request too slow for the event loop, done on the worker thread
+		struct task{
+			int fd;
+			unsigned long long connection; // which connection on <fd>, descriptors are reused
+			char op;
+			std::vector<std::string> args;
+			crypto::secret key; // MASTER, derived from the new master password, the loop applies it
+			std::string out; // the reply, unless it's left to the loop
+		};
+
+		void work();
+
+		Manager &mgr;
+		const std::string name;
+		const unsigned idle; // seconds without any client connected before the agent exits, 0 for never
+		int listener;
+		int poll;
+		int signals;
+		int wakeup; // eventfd the worker signals when it's done with a task
+		std::deque<task> queued; // under <lock>
+		std::vector<task> done; // under <lock>
+		bool stopping; // under <lock>
+		std::mutex lock;
+		std::condition_variable cv;
+		std::thread worker;
+	};
+
+	class client{
+	public:
+		client(const std::string&);
+		client(const client&) = delete;
+		~client();
+		Password find(const std::string&);
+		void add(const Password&);
+		void edit(const std::string&, const std::string&, const std::string&, const std::string&);
+		void remove(const std::string&);
+		void master(const std::string&, const std::string&);
+		void flush();
+		void snapshot(std::vector<Password>&);
+		void stop();
+
+	private:
+		std::vector<std::string> call(char, const std::vector<std::string_view>&);
+
+		int fd;
+	};
+}
+
+#endif // AGENT_H
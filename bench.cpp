@@ -0,0 +1,505 @@
+// passwords-bench, timings for the parts of the database code that have to stay fast
+//
+//   passwords-bench [index | unlock | search | fuzzy | records | backups]...    run the named benchmarks, or all of them
+//
+//   index     add, find and remove at 1k, 100k and 1M entries
+//   unlock    opening 100k and 1M entries, with the segments decrypted on one core against all of them
+//   search    filtering 1M names through the folded name arena against lowercasing every name and calling find()
+//   fuzzy     building the trigram index at 100k and 1M entries, queries against it, and adds and removes once it's built
+//   records   writing and parsing 200k text records where about half the characters need escaping, in MB/s
+//   backups   what the daily backups of 20k entries take on the disk over a year of 20 changes a day, against full copies
+//
+// scratch databases go in a "passwords-bench" folder in the temp folder, which is removed afterwards
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <memory>
+#include <thread>
+
+#include <QDir>
+#include <QDate>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "Manager.h"
+#include "search.h"
+
+#define MASTER "bench"
+
+static std::unique_ptr<Manager> current; // the scratch database, see vault()
+
+static void index();
+static void unlock();
+static void filter();
+static std::string to_lower(std::string_view);
+static void similar();
+static void records();
+static std::string escapable(std::mt19937&, unsigned);
+static void backups();
+static long long size(const std::string&);
+static double open_time(bool);
+static Manager &vault(unsigned, std::mt19937&);
+static void cleanup();
+static std::string scratch();
+static std::string random_string(std::mt19937&, unsigned);
+static double since(std::chrono::steady_clock::time_point);
+
+int main(int argc, char **argv){
+	std::vector<std::string> names(argv + 1, argv + argc);
+	if(names.empty())
+		names = {"index", "unlock", "search", "fuzzy", "records", "backups"};
+
+	try{
+		for(const std::string &name : names){
+			if(name == "index")
+				index();
+			else if(name == "unlock")
+				unlock();
+			else if(name == "search")
+				filter();
+			else if(name == "fuzzy")
+				similar();
+			else if(name == "records")
+				records();
+			else if(name == "backups")
+				backups();
+			else{
+				std::cerr << "usage: " << argv[0] << " [index | unlock | search | fuzzy | records | backups]..." << std::endl;
+				return 1;
+			}
+		}
+	}catch(const std::exception &e){
+		std::cerr << e.what() << std::endl;
+		cleanup();
+		return 1;
+	}
+
+	cleanup();
+	return 0;
+}
+
+// the name index at 1k, 100k and 1M entries, per operation
+// the database is filled in one go, then 250 adds and 250 removes are timed, too few to compact the journal in between,
+// and finds are timed over every entry
+void index(){
+	std::cout << "index: entries, add, find, remove (microseconds per operation)" << std::endl;
+
+	const unsigned changes = 250;
+	std::mt19937 rng(1);
+	for(const unsigned count : {1000u, 100000u, 1000000u}){
+		Manager &mgr = vault(count, rng);
+		std::vector<std::string> names;
+		names.reserve(count);
+		for(const Password &pw : mgr.get())
+			names.emplace_back(pw.name());
+
+		std::vector<Password> added(changes);
+		for(Password &pw : added){
+			pw.set_name(random_string(rng, 16));
+			pw.set_username(random_string(rng, 12));
+			pw.set_password(random_string(rng, 20));
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		for(const Password &pw : added)
+			mgr.add(pw);
+		const double add = since(start);
+
+		std::shuffle(names.begin(), names.end(), rng);
+		start = std::chrono::steady_clock::now();
+		std::string::size_type total = 0;
+		for(const std::string &name : names)
+			total += mgr.find(name).username().length();
+		const double find = since(start);
+
+		start = std::chrono::steady_clock::now();
+		for(unsigned i = 0; i < changes; ++i)
+			mgr.remove(names[i]);
+		const double remove = since(start);
+
+		mgr.flush();
+		std::cout << std::setw(9) << count << std::fixed << std::setprecision(3)
+			<< std::setw(10) << add * 1e6 / changes
+			<< std::setw(10) << find * 1e6 / count
+			<< std::setw(10) << remove * 1e6 / changes
+			<< (total == 0 ? " (no entries found)" : "") << std::endl;
+	}
+}
+
+// opening with every password decrypted, best of three. the key derivation is the same whatever the size and is calibrated
+// to take about half a second, so it's timed on an empty database and left out
+void unlock(){
+	const unsigned cores = std::thread::hardware_concurrency();
+	std::cout << "unlock: entries, 1 core, " << cores << " cores (milliseconds, without the key derivation)" << std::endl;
+
+	std::mt19937 rng(2);
+	vault(0, rng);
+	current.reset();
+	const double kdf = open_time(false);
+
+	for(const unsigned count : {100000u, 1000000u}){
+		vault(count, rng);
+		current.reset();
+
+		std::cout << std::setw(9) << count << std::fixed << std::setprecision(1);
+#ifdef __linux__
+		std::cout << std::setw(10) << (open_time(true) - kdf) * 1e3;
+#else
+		std::cout << std::setw(10) << "-";
+#endif
+		std::cout << std::setw(10) << (open_time(false) - kdf) * 1e3 << std::endl;
+	}
+}
+
+// the list's filter over 1M names, per query, best of three. the arena is built once like the list does on a reload,
+// the old way lowercased every name into a new string and searched that
+void filter(){
+	std::cout << "search: query, matches, arena, to_lower + find (milliseconds per query)" << std::endl;
+
+	const unsigned count = 1000000;
+	std::mt19937 rng(3);
+	std::vector<std::string> names(count);
+	std::string::size_type bytes = 0;
+	for(std::string &name : names){
+		name = random_string(rng, 6 + rng() % 20);
+		name[0] = toupper(name[0]);
+		bytes += name.length();
+	}
+
+	search::arena arena;
+	arena.reserve(names.size(), bytes);
+	for(const std::string &name : names)
+		arena.push(name);
+
+	for(const std::string query : {"a", "Qx", "bank", "Account", "zzzzzz"}){
+		std::vector<std::vector<std::string>::size_type> rows;
+		double scan = 0;
+		for(int i = 0; i < 3; ++i){
+			const auto start = std::chrono::steady_clock::now();
+			arena.match(search::fold(query), rows);
+			const double time = since(start);
+			if(i == 0 || time < scan)
+				scan = time;
+		}
+
+		std::vector<std::vector<std::string>::size_type> found;
+		double naive = 0;
+		for(int i = 0; i < 3; ++i){
+			const auto start = std::chrono::steady_clock::now();
+			found.clear();
+			for(std::vector<std::string>::size_type j = 0; j < names.size(); ++j){
+				if(to_lower(names[j]).find(to_lower(query)) != std::string::npos)
+					found.push_back(j);
+			}
+			const double time = since(start);
+			if(i == 0 || time < naive)
+				naive = time;
+		}
+
+		std::cout << std::setw(9) << query << std::setw(9) << rows.size() << std::fixed << std::setprecision(2)
+			<< std::setw(10) << scan * 1e3
+			<< std::setw(10) << naive * 1e3
+			<< (rows != found ? " (the results differ)" : "") << std::endl;
+	}
+}
+
+// how the list used to fold names, a new string each time
+std::string to_lower(std::string_view s){
+	std::string lower(s);
+	for(char &c : lower)
+		c = tolower((unsigned char)c);
+
+	return lower;
+}
+
+// the fuzzy search over entries whose usernames all end in "@example.com", so a few of every query's trigrams are in every entry
+// the index is built by the first query, then each query is timed best of three, then 250 adds and 250 removes
+void similar(){
+	std::cout << "fuzzy: entries, build (milliseconds), username, typo, \"example\" (milliseconds per query), add, remove (microseconds)" << std::endl;
+
+	const unsigned changes = 250;
+	std::mt19937 rng(5);
+	for(const unsigned count : {100000u, 1000000u}){
+		Manager &mgr = vault(count, rng);
+		const std::string username(mgr.get()[count / 2].username());
+		std::string typo(mgr.get()[count / 3].name());
+		std::swap(typo[3], typo[4]);
+
+		auto start = std::chrono::steady_clock::now();
+		mgr.fuzzy("", 1);
+		const double build = since(start);
+
+		std::cout << std::setw(9) << count << std::fixed << std::setprecision(1) << std::setw(10) << build * 1e3 << std::setprecision(3);
+		for(const std::string &query : {username, typo, std::string("example")}){
+			double best = 0;
+			for(int i = 0; i < 3; ++i){
+				start = std::chrono::steady_clock::now();
+				mgr.fuzzy(query, 50);
+				const double time = since(start);
+				if(i == 0 || time < best)
+					best = time;
+			}
+			std::cout << std::setw(10) << best * 1e3;
+		}
+
+		std::vector<Password> added(changes);
+		for(Password &pw : added){
+			pw.set_name(random_string(rng, 16));
+			pw.set_username(random_string(rng, 12) + "@example.com");
+			pw.set_password(random_string(rng, 20));
+		}
+
+		start = std::chrono::steady_clock::now();
+		for(const Password &pw : added)
+			mgr.add(pw);
+		const double add = since(start);
+
+		start = std::chrono::steady_clock::now();
+		for(unsigned i = 0; i < changes; ++i)
+			mgr.remove(std::string(mgr.get()[rng() % mgr.get().size()].name()));
+		const double remove = since(start);
+
+		mgr.flush();
+		std::cout << std::setprecision(1) << std::setw(10) << add * 1e6 / changes << std::setw(10) << remove * 1e6 / changes << std::endl;
+	}
+}
+
+// Password::serialize and Password::deserialize over the text records of 200k entries, best of three
+// parsing goes a line at a time over views into the one buffer, the way Manager::read does
+void records(){
+	std::cout << "records: MB, serialize, parse (MB/s)" << std::endl;
+
+	const unsigned count = 200000;
+	std::mt19937 rng(4);
+	std::vector<Password> entries(count);
+	for(Password &pw : entries){
+		pw.set_name(escapable(rng, 16 + rng() % 32));
+		pw.set_username(escapable(rng, 12 + rng() % 20));
+		pw.set_password(escapable(rng, 20 + rng() % 20));
+	}
+
+	std::string text;
+	double serialize = 0;
+	for(int i = 0; i < 3; ++i){
+		text.clear();
+		const auto start = std::chrono::steady_clock::now();
+		for(const Password &pw : entries)
+			pw.serialize(text);
+		const double time = since(start);
+		if(i == 0 || time < serialize)
+			serialize = time;
+	}
+
+	std::vector<Password> parsed(count);
+	double parse = 0;
+	for(int i = 0; i < 3; ++i){
+		const auto start = std::chrono::steady_clock::now();
+		std::string_view rest = text;
+		for(Password &pw : parsed){
+			const std::string_view::size_type end = rest.find('\n');
+			pw.deserialize(rest.substr(0, end));
+			rest.remove_prefix(end + 1);
+		}
+		const double time = since(start);
+		if(i == 0 || time < parse)
+			parse = time;
+	}
+
+	bool same = true;
+	for(unsigned i = 0; i < count; ++i)
+		same = same && parsed[i].name() == entries[i].name() && parsed[i].username() == entries[i].username() && parsed[i].password() == entries[i].password();
+
+	const double mb = text.length() / 1e6;
+	std::cout << std::fixed << std::setprecision(1) << std::setw(9) << mb
+		<< std::setw(10) << mb / serialize
+		<< std::setw(10) << mb / parse
+		<< (same ? "" : " (the parsed records differ)") << std::endl;
+}
+
+// a random field where about every other character is a ',' or '\\'
+std::string escapable(std::mt19937 &rng, unsigned length){
+	std::string s(length, 0);
+	for(char &c : s){
+		const unsigned r = rng();
+		c = r % 2 ? (r & 2 ? ',' : '\\') : 'a' + r / 4 % 26;
+	}
+
+	return s;
+}
+
+// a year of days with a few changes each, and the backups they leave behind, with the usual pruning
+// the backup a day gets is named for today, since that's the only day the database code knows, so once the day is done it's
+// renamed to the day it stands for, a year ago plus however many days have gone by. the next day then opens the database
+// anew, which finds that as the newest backup and makes another one with its first change
+// the full copies are what the backups that are left would take if each was a copy of the database like they used to be
+void backups(){
+	std::cout << "backups: day, backups kept, chunked, full copies (kilobytes)" << std::endl;
+
+	const unsigned days = 365;
+	const unsigned changes = 20;
+	std::mt19937 rng(5);
+	vault(20000, rng);
+	current.reset();
+
+	const std::string dir = scratch();
+	const long long today = QDate::currentDate().toJulianDay();
+	const long long start = today - days - 1;
+	const auto name = [](const QDate &date){
+		return std::to_string(date.year()) + "_" + std::to_string(date.month()) + "_" + std::to_string(date.day()) + ".backup";
+	};
+
+	// the one made when the scratch database was created goes before the year
+	if(!QDir(dir.c_str()).rename(name(QDate::fromJulianDay(today)).c_str(), name(QDate::fromJulianDay(start - 1)).c_str()))
+		throw Manager::ManagerException("the scratch database has no backup");
+
+	std::map<std::string, long long> copies; // backup -> size of the database it was made from
+	long long before = size(dir + "/db");
+	for(unsigned day = 0; day < days; ++day){
+		{
+			Manager mgr(dir);
+			mgr.open(MASTER);
+			std::vector<std::string> names;
+			for(unsigned i = 0; i < changes - 1; ++i)
+				names.emplace_back(mgr.get()[rng() % mgr.get().size()].name());
+			for(const std::string &entry : names)
+				mgr.edit(entry, entry, random_string(rng, 12) + "@example.com", random_string(rng, 20));
+
+			Password pw;
+			pw.set_name(random_string(rng, 16));
+			pw.set_username(random_string(rng, 12) + "@example.com");
+			pw.set_password(random_string(rng, 20));
+			mgr.add(pw);
+			mgr.flush();
+		}
+
+		const std::string dated = name(QDate::fromJulianDay(start + day));
+		if(!QDir(dir.c_str()).rename(name(QDate::fromJulianDay(today)).c_str(), dated.c_str()))
+			throw Manager::ManagerException("no backup was made on day " + std::to_string(day));
+		copies[dated] = before;
+		before = size(dir + "/db");
+
+		// every 30 days and at the end of the year
+		if((day + 1) % 30 != 0 && day + 1 != days)
+			continue;
+
+		long long chunked = 0;
+		long long full = 0;
+		unsigned kept = 0;
+		for(const auto &entry : QDir(dir.c_str()).entryList()){
+			const auto copy = copies.find(entry.toStdString());
+			if(copy == copies.end())
+				continue;
+
+			chunked += size(dir + "/" + entry.toStdString());
+			full += copy->second;
+			++kept;
+		}
+		for(const auto &entry : QDir((dir + "/chunks").c_str()).entryList()){
+			if(entry != "." && entry != "..")
+				chunked += size(dir + "/chunks/" + entry.toStdString());
+		}
+
+		std::cout << std::setw(9) << day + 1 << std::setw(9) << kept
+			<< std::setw(10) << chunked / 1024
+			<< std::setw(10) << full / 1024 << std::endl;
+	}
+}
+
+// bytes in the file <name>
+long long size(const std::string &name){
+	std::ifstream in(name, std::ifstream::binary | std::ifstream::ate);
+	return in ? (long long)in.tellg() : 0;
+}
+
+// Manager::open on the scratch database, best of three, on the first core the process may use if <single>
+// the reader still starts a thread per core then, they just take turns
+double open_time(bool single){
+#ifdef __linux__
+	cpu_set_t all;
+	sched_getaffinity(0, sizeof(all), &all);
+	if(single){
+		cpu_set_t one;
+		CPU_ZERO(&one);
+		for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu){
+			if(CPU_ISSET(cpu, &all)){
+				CPU_SET(cpu, &one);
+				break;
+			}
+		}
+		sched_setaffinity(0, sizeof(one), &one);
+	}
+#else
+	(void)single;
+#endif
+
+	double best = 0;
+	for(int i = 0; i < 3; ++i){
+		Manager mgr(scratch());
+		const auto start = std::chrono::steady_clock::now();
+		mgr.open(MASTER);
+		const double time = since(start);
+		if(i == 0 || time < best)
+			best = time;
+	}
+
+#ifdef __linux__
+	sched_setaffinity(0, sizeof(all), &all);
+#endif
+	return best;
+}
+
+// a scratch database of <count> random entries, saved and opened, replacing the previous one
+Manager &vault(unsigned count, std::mt19937 &rng){
+	cleanup();
+	const std::string dir = scratch();
+	QDir().mkpath(dir.c_str());
+	Manager::generate(dir, MASTER);
+
+	std::vector<Password> entries(count);
+	for(Password &pw : entries){
+		pw.set_name(random_string(rng, 16));
+		pw.set_username(random_string(rng, 12) + "@example.com");
+		pw.set_password(random_string(rng, 20));
+	}
+
+	{
+		Manager filler(dir);
+		filler.open(MASTER);
+		filler.replace(std::move(entries));
+		filler.flush();
+	}
+
+	current.reset(new Manager(dir));
+	current->open(MASTER);
+	return *current;
+}
+
+void cleanup(){
+	current.reset();
+	QDir(scratch().c_str()).removeRecursively();
+}
+
+std::string scratch(){
+	return QDir::tempPath().toStdString() + "/passwords-bench";
+}
+
+std::string random_string(std::mt19937 &rng, unsigned length){
+	std::string s(length, 0);
+	for(char &c : s)
+		c = 'a' + rng() % 26;
+
+	return s;
+}
+
+double since(std::chrono::steady_clock::time_point start){
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
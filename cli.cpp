@@ -0,0 +1,421 @@
+// passwords-cli, the database without the gui, for scripts
+//
+//   passwords-cli [FILE]              run the commands in FILE, or on stdin after the master password
+//   passwords-cli --backups           list the backups, oldest first
+//   passwords-cli --diff FROM [TO]    what changed from backup FROM to backup TO, or to the database if there's no TO
+//   passwords-cli --restore DATE      put the entries of the backup of DATE (2024_5_17), or the newest one before it, back
+//                                     in the database in place of the current ones. DATE can also be the name of a backup
+//                                     from --backups, like the 2024_5_17.1.backup the entries replaced on that day went to
+//   passwords-cli --agent [SECONDS]   unlock the database and keep it unlocked in the background until nothing has been
+//                                     connected to it for SECONDS (900 by default, 0 for never), like ssh-agent
+//   passwords-cli --lock              stop the agent
+//
+// the master password is the first line of stdin (asked for without echo on a terminal). the database is unlocked once
+// and every command runs against it in the same process, or in the agent if one is running, and then no password is read.
+// --diff and --restore always read it, the agent never hands out the master password and backups can't be opened without it.
+// a command is one line of tab separated fields:
+//
+//   get NAME                                  ok NAME USER PASSWORD
+//   add NAME USER PASSWORD                    ok
+//   edit NAME NEWNAME NEWUSER NEWPASSWORD     ok
+//   remove NAME                               ok
+//
+// and is answered by one line, "error" and a message instead of "ok" if it failed
+// tabs, newlines and backslashes in fields are written \t, \n and \\ both ways
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstdio>
+
+#include "Manager.h"
+#include "agent.h"
+
+#define AGENT_IDLE_SECONDS 900
+
+template<typename T> static int batch(T&, std::istream&);
+static int start_agent(unsigned);
+static int diff(Manager&, const std::string&, const std::string&);
+static int restore(Manager&, const std::string&);
+static std::vector<std::string> split(const std::string&);
+static std::string escape(std::string_view);
+static std::string ask_password();
+
+int main(int argc, char **argv){
+	const std::string mode = argc > 1 ? argv[1] : "";
+	const bool backups = mode == "--backups" && argc == 2;
+	const bool changes = mode == "--diff" && (argc == 3 || argc == 4);
+	const bool rollback = mode == "--restore" && argc == 3;
+	const bool serve = mode == "--agent" && (argc == 2 || (argc == 3 && std::string(argv[2]).find_first_not_of("0123456789") == std::string::npos));
+	const bool lock = mode == "--lock" && argc == 2;
+	const bool commands = argc == 1 || (argc == 2 && mode.compare(0, 2, "--") != 0);
+	if(!backups && !changes && !rollback && !serve && !lock && !commands){
+		std::cerr << "usage: " << argv[0] << " [FILE | --backups | --diff FROM [TO] | --restore DATE | --agent [SECONDS] | --lock]" << std::endl;
+		return 1;
+	}
+
+	try{
+		if(serve)
+			return start_agent(argc == 3 ? std::stoul(argv[2]) : AGENT_IDLE_SECONDS);
+
+		if(lock){
+			try{
+				agent::client(agent::path(Manager::default_path())).stop();
+			}catch(const Manager::NotFound&){
+				std::cerr << "No agent is running" << std::endl;
+				return 1;
+			}
+			return 0;
+		}
+
+		Manager mgr(Manager::default_path());
+
+		if(backups){
+			for(const std::string &name : mgr.backups())
+				std::cout << name << std::endl;
+			return 0;
+		}
+
+		if(rollback){
+			// the agent would go on serving and writing the entries it has
+			try{
+				agent::client running(agent::path(Manager::default_path()));
+				std::cerr << "An agent has the database open, stop it with --lock first" << std::endl;
+				return 1;
+			}catch(const Manager::NotFound&){}
+
+			mgr.open(ask_password());
+			return restore(mgr, argv[2]);
+		}
+
+		std::ifstream file;
+		if(commands && argc == 2){
+			file.open(argv[1]);
+			if(!file){
+				std::cerr << "Could not open \"" << argv[1] << "\"" << std::endl;
+				return 1;
+			}
+		}
+
+		std::istream &in = file.is_open() ? file : std::cin;
+
+		// an agent already has every password decrypted, hand it the commands instead of unlocking again
+		if(commands){
+			std::unique_ptr<agent::client> remote;
+			try{
+				remote.reset(new agent::client(agent::path(Manager::default_path())));
+			}catch(const Manager::NotFound&){}
+			if(remote)
+				return batch(*remote, in);
+		}
+
+		// every password is decrypted up front, lookups don't decrypt anything
+		mgr.open(ask_password());
+
+		if(changes)
+			return diff(mgr, argv[2], argc == 4 ? argv[3] : "");
+		return batch(mgr, in);
+	}catch(const Manager::NotFound&){
+		std::cerr << "No such database or backup" << std::endl;
+	}catch(const Manager::IncorrectPassword&){
+		std::cerr << "Incorrect master password" << std::endl;
+	}catch(const Manager::Corrupt&){
+		std::cerr << "The database at \"" << Manager::default_path() << "\" appears to be corrupt" << std::endl;
+	}catch(const std::exception &e){
+		std::cerr << e.what() << std::endl;
+	}
+
+	return 1;
+}
+
+// answer every command in <in>, the exit status is 1 if any of them failed
+// <db> is the unlocked Manager or an agent::client, they take the same commands
+template<typename T> int batch(T &db, std::istream &in){
+	bool failed = false;
+
+	std::string line;
+	while(std::getline(in, line)){
+		if(line.length() > 0 && line.back() == '\r')
+			line.pop_back();
+		if(line.length() == 0)
+			continue;
+
+		const std::vector<std::string> fields = split(line);
+		const std::string &cmd = fields[0];
+
+		// '\n' instead of std::endl, flushing after every answer would cost more than the lookups
+		try{
+			if(cmd == "get" && fields.size() == 2){
+				const Password &pw = db.find(fields[1]);
+				std::cout << "ok\t" << escape(pw.name()) << '\t' << escape(pw.username()) << '\t' << escape(pw.password()) << '\n';
+			}
+			else if(cmd == "add" && fields.size() == 4){
+				Password pw;
+				pw.set_name(fields[1]);
+				pw.set_username(fields[2]);
+				pw.set_password(fields[3]);
+				db.add(pw);
+				std::cout << "ok\n";
+			}
+			else if(cmd == "edit" && fields.size() == 5){
+				db.edit(fields[1], fields[2], fields[3], fields[4]);
+				std::cout << "ok\n";
+			}
+			else if(cmd == "remove" && fields.size() == 2){
+				db.remove(fields[1]);
+				std::cout << "ok\n";
+			}
+			else{
+				std::cout << "error\tunknown command or wrong number of fields\n";
+				failed = true;
+			}
+		}catch(const std::exception &e){
+			std::cout << "error\t" << escape(e.what()) << '\n';
+			failed = true;
+		}
+	}
+	std::cout << std::flush;
+
+	// changes are written in the background, wait for them so a failed write shows up in the exit status
+	try{
+		db.flush();
+	}catch(const std::exception &e){
+		std::cerr << e.what() << std::endl;
+		failed = true;
+	}
+
+	return failed ? 1 : 0;
+}
+
+// print what changed between two backups, or a backup and the database
+int diff(Manager &mgr, const std::string &from, const std::string &to){
+	// "2024_5_17" or "2024_5_17.backup"
+	const auto backup = [](std::string name){
+		const std::string suffix = ".backup";
+		if(name.length() > 0 && (name.length() < suffix.length() || name.compare(name.length() - suffix.length(), suffix.length(), suffix) != 0))
+			name += suffix;
+		return name;
+	};
+
+	mgr.diff(backup(from), backup(to), [](const Password *old, const Password *current){
+		if(old == NULL){
+			std::cout << "+ " << current->name() << " (" << current->username() << ")\n";
+		}
+		else if(current == NULL){
+			std::cout << "- " << old->name() << " (" << old->username() << ")\n";
+		}
+		else{
+			std::cout << "~ " << current->name();
+			if(old->username() != current->username())
+				std::cout << " (user name " << old->username() << " -> " << current->username() << ")";
+			if(old->password() != current->password())
+				std::cout << " (password changed)";
+			std::cout << '\n';
+		}
+	});
+	std::cout << std::flush;
+
+	return 0;
+}
+
+#ifdef _WIN32
+int start_agent(unsigned){
+	std::cerr << "The agent needs unix domain sockets, it isn't available on Windows" << std::endl;
+	return 1;
+}
+#else
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+// unlock the database and leave an agent serving it in the background, the socket's path is printed once it's listening
+int start_agent(unsigned idle){
+	const std::string dir = Manager::default_path();
+	const std::string master = ask_password();
+
+	// the child writes "ok" or why it failed down <status> and the parent exits with that
+	int status[2];
+	if(pipe(status) != 0)
+		throw Manager::ManagerException("Could not start the agent");
+
+	// before the Manager exists, its persistence thread wouldn't survive the fork
+	const pid_t pid = fork();
+	if(pid == -1)
+		throw Manager::ManagerException("Could not start the agent");
+
+	if(pid > 0){
+		close(status[1]);
+		std::string message;
+		char buffer[512];
+		ssize_t got;
+		while((got = read(status[0], buffer, sizeof(buffer))) > 0)
+			message.append(buffer, got);
+		close(status[0]);
+
+		if(message == "ok"){
+			std::cout << agent::path(dir) << std::endl;
+			return 0;
+		}
+		std::cerr << (message.length() > 0 ? message : "The agent exited") << std::endl;
+		return 1;
+	}
+
+	close(status[0]);
+	setsid();
+
+	const auto report = [&status](const std::string &message){
+		if(status[1] == -1)
+			return;
+		if(write(status[1], message.data(), message.length()) < 0){}
+		close(status[1]);
+		status[1] = -1;
+	};
+
+	// the agent waits for these on a signalfd, every thread has to block them or one could still be killed by them
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	try{
+		Manager mgr(dir);
+		mgr.open(master);
+		agent::server server(mgr, agent::path(dir), idle);
+		report("ok");
+
+		const int null = open("/dev/null", O_RDWR);
+		dup2(null, STDIN_FILENO);
+		dup2(null, STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+		close(null);
+
+		server.run();
+		mgr.flush();
+		return 0;
+	}catch(const Manager::NotFound&){
+		report("No such database");
+	}catch(const Manager::IncorrectPassword&){
+		report("Incorrect master password");
+	}catch(const Manager::Corrupt&){
+		report("The database at \"" + dir + "\" appears to be corrupt");
+	}catch(const std::exception &e){
+		report(e.what());
+	}
+
+	return 1;
+}
+#endif // _WIN32
+
+// replace the entries with the ones from the backup of <date>, the date part of a backup's name, or the backup named <date>
+int restore(Manager &mgr, const std::string &date){
+	const std::string suffix = ".backup";
+	std::vector<Password> entries;
+	if(date.length() > suffix.length() && date.compare(date.length() - suffix.length(), suffix.length(), suffix) == 0)
+		entries = mgr.restore(date);
+	else{
+		int year, month, day;
+		if(sscanf(date.c_str(), "%d_%d_%d", &year, &month, &day) != 3){
+			std::cerr << "\"" << date << "\" is not a date like 2024_5_17" << std::endl;
+			return 1;
+		}
+		entries = mgr.restore(year, month, day);
+	}
+
+	mgr.replace(std::move(entries));
+	mgr.flush();
+	std::cout << mgr.get().size() << " entries restored" << std::endl;
+
+	return 0;
+}
+
+// tab separated fields, unescaped
+std::vector<std::string> split(const std::string &line){
+	std::vector<std::string> fields(1);
+
+	for(std::string::size_type i = 0; i < line.length(); ++i){
+		const char c = line[i];
+		if(c == '\t'){
+			fields.emplace_back();
+		}
+		else if(c == '\\' && i + 1 < line.length()){
+			const char next = line[++i];
+			fields.back().push_back(next == 't' ? '\t' : next == 'n' ? '\n' : next);
+		}
+		else
+			fields.back().push_back(c);
+	}
+
+	return fields;
+}
+
+std::string escape(std::string_view field){
+	std::string out;
+	out.reserve(field.length());
+
+	for(const char c : field){
+		if(c == '\t')
+			out += "\\t";
+		else if(c == '\n')
+			out += "\\n";
+		else if(c == '\\')
+			out += "\\\\";
+		else
+			out.push_back(c);
+	}
+
+	return out;
+}
+
+#ifdef _WIN32
+#include <windows.h>
+// read a line from the console without echoing it
+std::string ask_password(){
+	HANDLE in = GetStdHandle(STD_INPUT_HANDLE);
+	DWORD mode;
+	const bool console = GetConsoleMode(in, &mode) != 0;
+	if(console){
+		std::cerr << "Master password: " << std::flush;
+		SetConsoleMode(in, mode & ~ENABLE_ECHO_INPUT);
+	}
+
+	std::string password;
+	std::getline(std::cin, password);
+	if(password.length() > 0 && password.back() == '\r')
+		password.pop_back();
+
+	if(console){
+		SetConsoleMode(in, mode);
+		std::cerr << std::endl;
+	}
+	return password;
+}
+#else
+#include <termios.h>
+#include <unistd.h>
+// read a line from the terminal without echoing it
+std::string ask_password(){
+	termios old;
+	const bool tty = tcgetattr(STDIN_FILENO, &old) == 0;
+	if(tty){
+		std::cerr << "Master password: " << std::flush;
+		termios quiet = old;
+		quiet.c_lflag &= ~ECHO;
+		tcsetattr(STDIN_FILENO, TCSANOW, &quiet);
+	}
+
+	std::string password;
+	std::getline(std::cin, password);
+	if(password.length() > 0 && password.back() == '\r')
+		password.pop_back();
+
+	if(tty){
+		tcsetattr(STDIN_FILENO, TCSANOW, &old);
+		std::cerr << std::endl;
+	}
+	return password;
+}
+#endif // _WIN32
@@ -0,0 +1,377 @@
+// passwords-crashtest, kills a process that's changing the database at random moments, over and over, and checks that the
+// database always opens afterwards with a state the changes actually went through, including every change that was flushed
+//
+//   passwords-crashtest [ROUNDS]
+//
+// the changes are a fixed sequence, so the test knows every state the database is allowed to be in. they're flushed in
+// batches, and there are enough of them that the journal is compacted and the database is rewritten all through a round
+// random kills rarely land in the few instructions between two steps of a save, so after the random rounds the process is
+// killed at every step of writing the database and the journal in turn (the database code is built with CRASHTEST for
+// that, see CRASHPOINT in Manager.cpp), and then the journal is cut off part way through its last records, the way a crash
+// in the middle of an append leaves it
+// the scratch database goes in a "passwords-crashtest" folder in the temp folder, which is removed afterwards
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <random>
+
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <QDir>
+
+#include "Manager.h"
+
+#define MASTER "crash"
+#define ENTRIES 20000
+#define FLUSH_EVERY 25
+#define KEPT 100 // entries the changes leave in the database, the oldest one goes when another one is renamed
+#define KILL_MICROSECONDS 300000 // a round is killed somewhere in this many microseconds after the database is open
+#define POINT_HITS 2 // each crash point is tried the first and the second time the process gets to it
+#define POINT_SECONDS 60 // how long a process gets to reach a crash point before the round fails
+#define TAIL_RECORDS 3 // journal records the tail cuts go through
+
+typedef std::map<std::string, std::pair<std::string, std::string>> state;
+
+static void change(Manager&, unsigned long);
+static void change(state&, unsigned long);
+static bool round(const std::string&, state&, unsigned long&, std::mt19937&, const char*, unsigned, const std::string&);
+static bool tails(const std::string&, state&, unsigned long&);
+static void changer(const std::string&, unsigned long, int);
+static state load(const std::string&);
+static std::string slurp(const std::string&);
+static void spill(const std::string&, const std::string&);
+
+// the steps of Manager::save and Manager::append a process can be killed at
+static const char *const points[] = {"save written", "save replaced", "save synced", "save removed journal", "append opened", "append written", "append synced"};
+
+// set in the child before it opens the database, crashpoint() kills it the <crash_hits>th time it gets to <crash_at>
+static const char *crash_at = NULL;
+static unsigned crash_hits = 0;
+
+void crashpoint(const char *step){
+	if(crash_at != NULL && strcmp(step, crash_at) == 0 && --crash_hits == 0)
+		kill(getpid(), SIGKILL);
+}
+
+int main(int argc, char **argv){
+	const int rounds = argc > 1 ? atoi(argv[1]) : 50;
+	const std::string dir = QDir::tempPath().toStdString() + "/passwords-crashtest";
+
+	state expected;
+	unsigned long done = 0; // changes in <expected>
+	try{
+		QDir(dir.c_str()).removeRecursively();
+		QDir().mkpath(dir.c_str());
+		Manager::generate(dir, MASTER);
+
+		std::vector<Password> entries(ENTRIES);
+		for(unsigned i = 0; i < ENTRIES; ++i){
+			entries[i].set_name("entry " + std::to_string(i));
+			entries[i].set_username("user" + std::to_string(i) + "@example.com");
+			entries[i].set_password("password " + std::to_string(i));
+		}
+
+		Manager mgr(dir);
+		mgr.open(MASTER);
+		mgr.replace(std::move(entries));
+		mgr.flush();
+		expected = load(dir);
+	}catch(const std::exception &e){
+		std::cerr << "setup failed: " << e.what() << std::endl;
+		return 1;
+	}
+
+	std::mt19937 rng(1);
+	bool passed = true;
+	for(int i = 0; i < rounds && passed; ++i)
+		passed = round(dir, expected, done, rng, NULL, 0, "round " + std::to_string(i));
+
+	for(const char *point : points){
+		for(unsigned hit = 1; hit <= POINT_HITS && passed; ++hit)
+			passed = round(dir, expected, done, rng, point, hit, std::string(point) + " #" + std::to_string(hit));
+	}
+
+	if(passed)
+		passed = tails(dir, expected, done);
+
+	QDir(dir.c_str()).removeRecursively();
+	std::cout << (passed ? "passed" : "FAILED") << std::endl;
+	return passed ? 0 : 1;
+}
+
+// change number <i> of the sequence, every four of them add an entry, edit it, rename it and remove the renamed entry
+// from KEPT fours before, so no two of the states they go through are the same
+void change(Manager &mgr, unsigned long i){
+	const unsigned long group = i - i % 4;
+	const std::string name = "change " + std::to_string(group);
+	switch(i % 4){
+	case 0:{
+		Password pw;
+		pw.set_name(name);
+		pw.set_username("user" + std::to_string(i));
+		pw.set_password("password " + std::to_string(i));
+		mgr.add(pw);
+		break;
+	}
+	case 1:
+		mgr.edit(name, name, "edited" + std::to_string(i), "edited password " + std::to_string(i));
+		break;
+	case 2:
+		mgr.edit(name, name + " renamed", "renamed" + std::to_string(i), "renamed password " + std::to_string(i));
+		break;
+	case 3:
+		if(group >= KEPT * 4)
+			mgr.remove("change " + std::to_string(group - KEPT * 4) + " renamed");
+		break;
+	}
+}
+
+// the same change, on the expected state
+void change(state &entries, unsigned long i){
+	const unsigned long group = i - i % 4;
+	const std::string name = "change " + std::to_string(group);
+	switch(i % 4){
+	case 0:
+		entries[name] = std::make_pair("user" + std::to_string(i), "password " + std::to_string(i));
+		break;
+	case 1:
+		entries[name] = std::make_pair("edited" + std::to_string(i), "edited password " + std::to_string(i));
+		break;
+	case 2:
+		entries.erase(name);
+		entries[name + " renamed"] = std::make_pair("renamed" + std::to_string(i), "renamed password " + std::to_string(i));
+		break;
+	case 3:
+		if(group >= KEPT * 4)
+			entries.erase("change " + std::to_string(group - KEPT * 4) + " renamed");
+		break;
+	}
+}
+
+// fork a process that makes changes from number <done> on until it dies, then check the database opens with a state the
+// changes went through, and not one from before the last flush the process saw. it's killed at random, or with <point>
+// set, it kills itself the <hit>th time it gets there. <expected> and <done> are moved up to the state that was recovered
+bool round(const std::string &dir, state &expected, unsigned long &done, std::mt19937 &rng, const char *point, unsigned hit, const std::string &label){
+	int report[2];
+	if(pipe(report) != 0){
+		std::cout << label << ": pipe failed" << std::endl;
+		return false;
+	}
+
+	// no Manager may be alive here, its thread wouldn't survive the fork
+	const pid_t pid = fork();
+	if(pid == 0){
+		close(report[0]);
+		crash_at = point;
+		crash_hits = hit;
+		changer(dir, done, report[1]);
+		_exit(0);
+	}
+	close(report[1]);
+
+	// the child reports once before its first change, unlocking is too slow to kill it at random before that
+	unsigned long flushed = done;
+	unsigned long count;
+	const bool opened = read(report[0], &count, sizeof(count)) == sizeof(count);
+	int status = 0;
+	if(point == NULL){
+		if(opened)
+			usleep(rng() % KILL_MICROSECONDS);
+		kill(pid, SIGKILL);
+		waitpid(pid, &status, 0);
+	}
+	else{
+		bool died = false;
+		for(int i = 0; i < POINT_SECONDS * 100 && !died; ++i){
+			died = waitpid(pid, &status, WNOHANG) == pid;
+			if(!died)
+				usleep(10000);
+		}
+		if(!died){
+			kill(pid, SIGKILL);
+			waitpid(pid, NULL, 0);
+			std::cout << label << ": the process never got there" << std::endl;
+			return false;
+		}
+	}
+
+	// the last change the child saw flushed
+	while(read(report[0], &count, sizeof(count)) == sizeof(count))
+		flushed = count;
+	close(report[0]);
+
+	if(!WIFSIGNALED(status)){
+		std::cout << label << ": the process wasn't killed" << std::endl;
+		return false;
+	}
+
+	state recovered;
+	try{
+		recovered = load(dir);
+	}catch(const std::exception &e){
+		std::cout << label << ": the database doesn't open: " << e.what() << std::endl;
+		return false;
+	}
+
+	// walk the changes forward until the recovered state comes up, it can't be before the flushed ones
+	while(done < flushed)
+		change(expected, done++);
+	const unsigned long limit = flushed + 1000000;
+	while(expected != recovered && done < limit)
+		change(expected, done++);
+
+	if(expected != recovered){
+		std::cout << label << ": the database holds a state the changes never went through" << std::endl;
+		return false;
+	}
+
+	std::cout << label << ": " << flushed << " changes flushed, " << done << " recovered" << std::endl;
+	return true;
+}
+
+// write TAIL_RECORDS changes to a fresh journal, then cut it off in the header and inside each of those records in turn
+// every cut has to open with a state from before the changes up to the last one, and a change made afterwards has to be
+// there after reopening, it would be lost if it went after the torn record instead of replacing it
+bool tails(const std::string &dir, state &expected, unsigned long &done){
+	const std::string dbname = dir + "/db";
+	const std::string journalname = dir + "/journal";
+	try{
+		// a full save first, so the journal has nothing but these changes in it
+		Manager mgr(dir);
+		mgr.open(MASTER);
+		mgr.master(MASTER, MASTER);
+		mgr.flush();
+		for(unsigned i = 0; i < TAIL_RECORDS; ++i){
+			change(mgr, done + i);
+			mgr.flush();
+		}
+	}catch(const std::exception &e){
+		std::cout << "tails: " << e.what() << std::endl;
+		return false;
+	}
+
+	const std::string db = slurp(dbname);
+	const std::string journal = slurp(journalname);
+
+	// the header, then a torn length, a torn iv, half the ciphertext and all but the last byte of each record, and all of it
+	std::vector<std::string::size_type> cuts = {0, 6, 12};
+	std::vector<std::string::size_type> ends;
+	std::string::size_type at = 12;
+	while(at + 8 <= journal.length()){
+		unsigned long long length;
+		memcpy(&length, journal.data() + at, sizeof(length));
+		const std::string::size_type end = at + 8 + 12 + length;
+		cuts.insert(cuts.end(), {at + 5, at + 8 + 6, at + 20 + length / 2, end - 1, end});
+		ends.push_back(end);
+		at = end;
+	}
+	if(at != journal.length() || cuts.size() != 3 + TAIL_RECORDS * 5){
+		std::cout << "tails: the journal doesn't hold " << TAIL_RECORDS << " records" << std::endl;
+		return false;
+	}
+
+	for(const std::string::size_type cut : cuts){
+		spill(dbname, db);
+		spill(journalname, journal.substr(0, cut));
+		const std::string label = "tail cut at " + std::to_string(cut) + " of " + std::to_string(journal.length());
+
+		state recovered;
+		state marked;
+		try{
+			recovered = load(dir);
+
+			Manager mgr(dir);
+			mgr.open(MASTER);
+			Password pw;
+			pw.set_name("after the tail");
+			pw.set_username("user");
+			pw.set_password("password");
+			mgr.add(pw);
+			mgr.flush();
+			marked = load(dir);
+		}catch(const std::exception &e){
+			std::cout << label << ": " << e.what() << std::endl;
+			return false;
+		}
+
+		// exactly the records that are whole before the cut
+		state walked = expected;
+		unsigned i = 0;
+		while(i < ends.size() && ends[i] <= cut)
+			change(walked, done + i++);
+		if(walked != recovered){
+			std::cout << label << ": the database doesn't hold the " << i << " changes before the cut" << std::endl;
+			return false;
+		}
+
+		walked["after the tail"] = std::make_pair("user", "password");
+		if(marked != walked){
+			std::cout << label << ": a change made after opening was lost" << std::endl;
+			return false;
+		}
+
+		std::cout << label << ": " << i << " of " << TAIL_RECORDS << " changes recovered" << std::endl;
+	}
+
+	spill(dbname, db);
+	spill(journalname, journal);
+	for(unsigned i = 0; i < TAIL_RECORDS; ++i)
+		change(expected, done++);
+	return true;
+}
+
+// the child: make changes from number <from> on until it's killed, writing the count down <report> once it's open and
+// after every flush
+void changer(const std::string &dir, unsigned long from, int report){
+	try{
+		Manager mgr(dir);
+		mgr.open(MASTER);
+		if(write(report, &from, sizeof(from)) != sizeof(from))
+			return;
+
+		for(unsigned long i = from;; ++i){
+			change(mgr, i);
+			if((i + 1) % FLUSH_EVERY == 0){
+				mgr.flush();
+				const unsigned long count = i + 1;
+				if(write(report, &count, sizeof(count)) != sizeof(count))
+					break;
+			}
+		}
+	}catch(const std::exception &e){
+		std::cerr << "the changing process failed: " << e.what() << std::endl;
+	}
+
+	// anything but a kill ends the round early, the parent checks whatever made it to the disk all the same
+	pause();
+}
+
+state load(const std::string &dir){
+	Manager mgr(dir);
+	mgr.open(MASTER);
+
+	state entries;
+	for(const Password &pw : mgr.get())
+		entries[std::string(pw.name())] = std::make_pair(std::string(pw.username()), pw.password());
+	return entries;
+}
+
+// the whole file, empty if there's none
+std::string slurp(const std::string &name){
+	std::ifstream in(name, std::ifstream::binary);
+	std::ostringstream contents;
+	contents << in.rdbuf();
+	return contents.str();
+}
+
+void spill(const std::string &name, const std::string &contents){
+	std::ofstream out(name, std::ofstream::binary | std::ofstream::trunc);
+	out.write(contents.data(), contents.length());
+}
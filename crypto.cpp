@@ -1,12 +1,20 @@
+#include <chrono>
+
 #include <openssl/aes.h>
 #include <openssl/err.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
 #include <string.h>
 
 #include "crypto.h"
 
 #define DEBUG(x) (std::string("[") + __FILE__ + ": " + __func__ + ": " + std::to_string(__LINE__) + "] " + x)
 
+#define KDF_MIN_ITERATIONS 10000
+#define KDF_CALIBRATION_ITERATIONS 20000
+
 // turn passphrase into raw key
+// legacy databases only, everything else goes through crypto::derive
 static void stretch(const std::string &pass, unsigned char *key, unsigned char *iv){
 	const int ret = EVP_BytesToKey(EVP_aes_256_cbc(), EVP_sha1(), NULL, (unsigned char*)pass.c_str(), pass.length(), 1, key, iv);
 	if(ret == 0)
@@ -16,16 +24,32 @@ static void stretch(const std::string &pass, unsigned char *key, unsigned char *
 //
 // encrypt stream object
 //
-crypto::encrypt_stream::encrypt_stream(const std::string &pw){
+crypto::encrypt_stream::encrypt_stream(const std::string &pw)
+	:cipher(CBC)
+{
 	// initialize the key and iv
 	stretch(pw, key, iv);
 
+	init();
+}
+
+crypto::encrypt_stream::encrypt_stream(const crypto::secret &s, const unsigned char *initvec, crypto::mode m)
+	:cipher(m)
+{
+	memcpy(key, s.key, sizeof(key));
+	memcpy(iv, initvec, cipher == GCM ? GCM_IV_SIZE : IV_SIZE);
+
+	init();
+}
+
+void crypto::encrypt_stream::init(){
 	// construct the evp cipher context
 	if(!(ctx = EVP_CIPHER_CTX_new()))
 		throw crypto::exception(DEBUG("couldn't construct evp cipher context"));
 
 	// initialize encryption operation
-	if(1 != EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key, iv))
+	// the default gcm iv length is GCM_IV_SIZE
+	if(1 != EVP_EncryptInit_ex(ctx, cipher == GCM ? EVP_aes_256_gcm() : EVP_aes_256_cbc(), NULL, key, iv))
 		throw crypto::exception(DEBUG("couldn't initialize the encryption operation"));
 }
 
@@ -33,6 +57,13 @@ crypto::encrypt_stream::~encrypt_stream(){
 	EVP_CIPHER_CTX_free(ctx);
 }
 
+// authenticate data that isn't encrypted (gcm only), must come before any call to encrypt()
+void crypto::encrypt_stream::aad(const unsigned char *data, int len){
+	int written;
+	if(cipher != GCM || 1 != EVP_EncryptUpdate(ctx, NULL, &written, data, len))
+		throw crypto::exception(DEBUG("could not add authenticated data"));
+}
+
 int crypto::encrypt_stream::encrypt(const unsigned char *plaintext, int plainlen, unsigned char *ciphertext, int cipherlen){
 	if(cipherlen < plainlen + BLOCK_SIZE - 1)
 		throw crypto::exception(DEBUG("the size of the ciphertext buffer must be at least (plainlen + BLOCK_SIZE - 1). BLOCKSIZE = 256"));
@@ -55,19 +86,40 @@ int crypto::encrypt_stream::finalize(unsigned char *ciphertext, int cipherlen){
 	return written;
 }
 
+// gcm only, call after finalize(). <tag> must be at least TAG_SIZE
+void crypto::encrypt_stream::get_tag(unsigned char *tag){
+	if(cipher != GCM || 1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, TAG_SIZE, tag))
+		throw crypto::exception(DEBUG("could not get the authentication tag"));
+}
+
 //
 // decrypt stream object
 //
-crypto::decrypt_stream::decrypt_stream(const std::string &pw){
+crypto::decrypt_stream::decrypt_stream(const std::string &pw)
+	:cipher(CBC)
+{
 	// init key and iv
 	stretch(pw, key, iv);
 
+	init();
+}
+
+crypto::decrypt_stream::decrypt_stream(const crypto::secret &s, const unsigned char *initvec, crypto::mode m)
+	:cipher(m)
+{
+	memcpy(key, s.key, sizeof(key));
+	memcpy(iv, initvec, cipher == GCM ? GCM_IV_SIZE : IV_SIZE);
+
+	init();
+}
+
+void crypto::decrypt_stream::init(){
 	// construct evp cipher context
 	if(!(ctx = EVP_CIPHER_CTX_new()))
 		throw crypto::exception(DEBUG("could not construct evp cipher context"));
 
 	// initialize decryption operation
-	if(1 != EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key, iv))
+	if(1 != EVP_DecryptInit_ex(ctx, cipher == GCM ? EVP_aes_256_gcm() : EVP_aes_256_cbc(), NULL, key, iv))
 		throw crypto::exception(DEBUG("could not initialize the decryption operation"));
 }
 
@@ -75,6 +127,13 @@ crypto::decrypt_stream::~decrypt_stream(){
 	EVP_CIPHER_CTX_free(ctx);
 }
 
+// authenticate data that isn't encrypted (gcm only), must come before any call to decrypt()
+void crypto::decrypt_stream::aad(const unsigned char *data, int len){
+	int written;
+	if(cipher != GCM || 1 != EVP_DecryptUpdate(ctx, NULL, &written, data, len))
+		throw crypto::exception(DEBUG("could not add authenticated data"));
+}
+
 int crypto::decrypt_stream::decrypt(const unsigned char *ciphertext, int cipherlen, unsigned char *plaintext, int plainlen){
 	if(plainlen < cipherlen + BLOCK_SIZE)
 		throw crypto::exception(DEBUG("the size of the plaintext buffer should be at least (cipherlen + BLOCKSIZE). BLOCKSIZE = 256"));
@@ -86,17 +145,68 @@ int crypto::decrypt_stream::decrypt(const unsigned char *ciphertext, int cipherl
 	return written;
 }
 
+// gcm only, call before finalize(). finalize() then fails if the data doesn't match the tag
+void crypto::decrypt_stream::set_tag(const unsigned char *tag){
+	if(cipher != GCM || 1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, TAG_SIZE, (void*)tag))
+		throw crypto::exception(DEBUG("could not set the authentication tag"));
+}
+
 int crypto::decrypt_stream::finalize(unsigned char *plaintext, int plainlen){
 	if(plainlen < BLOCK_SIZE)
 		throw crypto::exception(DEBUG("plainlen should be at least BLOCK_SIZE. BLOCK_SIZE = 256"));
 
 	int written;
 	if(1 != EVP_DecryptFinal_ex(ctx, plaintext, &written))
-		throw crypto::exception(DEBUG("incorrect padding format"));
+		throw crypto::exception(cipher == GCM ? DEBUG("authentication failed") : DEBUG("incorrect padding format"));
 
 	return written;
 }
 
+//
+// key derivation
+//
+crypto::secret crypto::derive(const std::string &pass, const crypto::kdf &params){
+	crypto::secret s;
+	s.params = params;
+
+	if(1 != PKCS5_PBKDF2_HMAC(pass.c_str(), pass.length(), params.salt, sizeof(params.salt), params.iterations, EVP_sha256(), sizeof(s.key), s.key))
+		throw crypto::exception(DEBUG("could not derive the key"));
+
+	return s;
+}
+
+// pick a fresh salt and an iteration count that takes about <milliseconds> on this machine
+crypto::kdf crypto::calibrate(int milliseconds){
+	crypto::kdf params;
+	params.iterations = KDF_CALIBRATION_ITERATIONS;
+	crypto::random(params.salt, sizeof(params.salt));
+
+	const auto start = std::chrono::steady_clock::now();
+	crypto::derive("calibration", params);
+	const long long elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+	const long long iterations = elapsed > 0 ? (long long)KDF_CALIBRATION_ITERATIONS * milliseconds * 1000 / elapsed : KDF_CALIBRATION_ITERATIONS;
+	params.iterations = iterations < KDF_MIN_ITERATIONS ? KDF_MIN_ITERATIONS : iterations > 0x7fffffff ? 0x7fffffff : iterations;
+
+	return params;
+}
+
+void crypto::random(unsigned char *buffer, int len){
+	if(1 != RAND_bytes(buffer, len))
+		throw crypto::exception(DEBUG("could not generate random bytes"));
+}
+
+// hmac-sha256 of <data>, written to <out> (MAC_SIZE bytes)
+// keyed by hmac(<s>, <purpose>) rather than by <s> itself, so the encryption key is never used for anything else
+void crypto::mac(const crypto::secret &s, const std::string &purpose, const unsigned char *data, unsigned long long length, unsigned char *out){
+	unsigned char key[MAC_SIZE];
+	unsigned int written;
+	if(HMAC(EVP_sha256(), s.key, sizeof(s.key), (const unsigned char*)purpose.c_str(), purpose.length(), key, &written) == NULL)
+		throw crypto::exception(DEBUG("could not derive the mac key"));
+	if(HMAC(EVP_sha256(), key, sizeof(key), data, length, out, &written) == NULL)
+		throw crypto::exception(DEBUG("could not compute the mac"));
+}
+
 //
 // one and done functions (full in memory encryption)
 //
@@ -121,3 +231,60 @@ void crypto::decrypt(const std::string &passwd, const std::vector<unsigned char>
 	const int written2 = decrypt.finalize(plaintext.data() + written1, plaintext.size() - written1);
 	plaintext.resize(written1 + written2);
 }
+
+void crypto::encrypt(const crypto::secret &s, const unsigned char *iv, const std::vector<unsigned char> &plaintext, std::vector<unsigned char> &ciphertext){
+	crypto::encrypt_stream encrypt(s, iv);
+
+	ciphertext.resize(plaintext.size() + BLOCK_SIZE - 1);
+
+	const int written1 = encrypt.encrypt(plaintext.data(), plaintext.size(), ciphertext.data(), ciphertext.size());
+	ciphertext.resize(written1 + BLOCK_SIZE);
+	const int written2 = encrypt.finalize(ciphertext.data() + written1, ciphertext.size() - written1);
+	ciphertext.resize(written1 + written2);
+}
+
+void crypto::decrypt(const crypto::secret &s, const unsigned char *iv, const std::vector<unsigned char> &ciphertext, std::vector<unsigned char> &plaintext){
+	crypto::decrypt_stream decrypt(s, iv);
+
+	plaintext.resize(ciphertext.size() + BLOCK_SIZE);
+
+	const int written1 = decrypt.decrypt(ciphertext.data(), ciphertext.size(), plaintext.data(), plaintext.size());
+	plaintext.resize(written1 + BLOCK_SIZE);
+	const int written2 = decrypt.finalize(plaintext.data() + written1, plaintext.size() - written1);
+	plaintext.resize(written1 + written2);
+}
+
+void crypto::seal(const crypto::secret &s, const unsigned char *iv, const std::vector<unsigned char> &plaintext, std::vector<unsigned char> &ciphertext){
+	crypto::encrypt_stream encrypt(s, iv, GCM);
+
+	ciphertext.resize(plaintext.size() + BLOCK_SIZE - 1);
+
+	const int written1 = encrypt.encrypt(plaintext.data(), plaintext.size(), ciphertext.data(), ciphertext.size());
+	ciphertext.resize(written1 + BLOCK_SIZE);
+	const int written2 = encrypt.finalize(ciphertext.data() + written1, ciphertext.size() - written1);
+	ciphertext.resize(written1 + written2 + TAG_SIZE);
+	encrypt.get_tag(ciphertext.data() + written1 + written2);
+}
+
+void crypto::unseal(const crypto::secret &s, const unsigned char *iv, const std::vector<unsigned char> &ciphertext, std::vector<unsigned char> &plaintext){
+	crypto::unseal(s, iv, ciphertext.data(), ciphertext.size(), plaintext);
+}
+
+// for ciphertext that isn't in a vector, e.g. straight out of a memory mapped file
+void crypto::unseal(const crypto::secret &s, const unsigned char *iv, const unsigned char *ciphertext, unsigned long long length, std::vector<unsigned char> &plaintext){
+	if(length < (unsigned)TAG_SIZE)
+		throw crypto::exception(DEBUG("ciphertext is too short to hold the authentication tag"));
+	if(length - TAG_SIZE > 0x7fffffff - BLOCK_SIZE)
+		throw crypto::exception(DEBUG("ciphertext is too long"));
+
+	crypto::decrypt_stream decrypt(s, iv, GCM);
+	const int cipherlen = length - TAG_SIZE;
+
+	plaintext.resize(cipherlen + BLOCK_SIZE);
+
+	const int written1 = decrypt.decrypt(ciphertext, cipherlen, plaintext.data(), plaintext.size());
+	decrypt.set_tag(ciphertext + cipherlen);
+	plaintext.resize(written1 + BLOCK_SIZE);
+	const int written2 = decrypt.finalize(plaintext.data() + written1, plaintext.size() - written1);
+	plaintext.resize(written1 + written2);
+}
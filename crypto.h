@@ -10,6 +10,15 @@
 
 namespace crypto{
 	const int BLOCK_SIZE = 256;
+	const int KEY_SIZE = 32;
+	const int IV_SIZE = 16;
+	const int GCM_IV_SIZE = 12;
+	const int TAG_SIZE = 16;
+	const int SALT_SIZE = 16;
+	const int MAC_SIZE = 32;
+
+	// CBC for legacy data, GCM authenticates the ciphertext as well
+	enum mode{ CBC, GCM };
 
 	class exception : public std::exception{
 	public:
@@ -22,16 +31,34 @@ namespace crypto{
 		const std::string message;
 	};
 
+	// pbkdf2 parameters, stored alongside the ciphertext
+	struct kdf{
+		unsigned iterations;
+		unsigned char salt[SALT_SIZE];
+	};
+
+	// derived key, along with the parameters that produced it
+	struct secret{
+		kdf params;
+		unsigned char key[KEY_SIZE];
+	};
+
 	class encrypt_stream{
 	public:
 		encrypt_stream(const std::string&);
+		encrypt_stream(const secret&, const unsigned char*, mode = CBC);
 		~encrypt_stream();
 
+		void aad(const unsigned char*, int);
 		int encrypt(const unsigned char*, int, unsigned char*, int);
 		int finalize(unsigned char*, int);
+		void get_tag(unsigned char*);
 
 	private:
+		void init();
+
 		EVP_CIPHER_CTX *ctx;
+		const mode cipher;
 		unsigned char key[32];
 		unsigned char iv[16];
 	};
@@ -39,20 +66,39 @@ namespace crypto{
 	class decrypt_stream{
 	public:
 		decrypt_stream(const std::string&);
+		decrypt_stream(const secret&, const unsigned char*, mode = CBC);
 		~decrypt_stream();
 
+		void aad(const unsigned char*, int);
 		int decrypt(const unsigned char*, int, unsigned char*, int);
+		void set_tag(const unsigned char*);
 		int finalize(unsigned char*, int);
 
 	private:
+		void init();
+
 		EVP_CIPHER_CTX *ctx;
+		const mode cipher;
 		unsigned char key[32];
 		unsigned char iv[16];
 	};
 
+	// key derivation
+	secret derive(const std::string&, const kdf&);
+	kdf calibrate(int);
+	void random(unsigned char*, int);
+	void mac(const secret&, const std::string&, const unsigned char*, unsigned long long, unsigned char*);
+
 	// "one-and-done" functions
 	void encrypt(const std::string&, const std::vector<unsigned char>&, std::vector<unsigned char>&);
 	void decrypt(const std::string&, const std::vector<unsigned char>&, std::vector<unsigned char>&);
+	void encrypt(const secret&, const unsigned char*, const std::vector<unsigned char>&, std::vector<unsigned char>&);
+	void decrypt(const secret&, const unsigned char*, const std::vector<unsigned char>&, std::vector<unsigned char>&);
+
+	// authenticated "one-and-done" functions, the GCM tag is appended to the ciphertext
+	void seal(const secret&, const unsigned char*, const std::vector<unsigned char>&, std::vector<unsigned char>&);
+	void unseal(const secret&, const unsigned char*, const std::vector<unsigned char>&, std::vector<unsigned char>&);
+	void unseal(const secret&, const unsigned char*, const unsigned char*, unsigned long long, std::vector<unsigned char>&);
 }
 
 #endif // CRYPTO_H
@@ -5,7 +5,6 @@
 #include "Dialog.h"
 
 static int run(QApplication&);
-static std::string get_db_path();
 
 #ifdef _WIN32
 #include <windows.h>
@@ -25,16 +24,18 @@ int main(int argc, char **argv){
 
 int run(QApplication &app){
 	try{
-		Manager mgr(get_db_path());
+		Manager mgr(Manager::default_path());
 
-		// ask user for master password
-		Greeter greeter;
-		if(!greeter.exec())
-			return 1;
-		const std::string master = greeter.password();
+		// a running agent already has the db unlocked, otherwise ask user for master password
+		if(!mgr.attach()){
+			Greeter greeter;
+			if(!greeter.exec())
+				return 1;
+			const std::string master = greeter.password();
 
-		// open the db
-		mgr.open(master);
+			// open the db
+			mgr.open(master, true);
+		}
 
 		Passwords passwords(mgr);
 		passwords.show();
@@ -49,7 +50,7 @@ int run(QApplication &app){
 		const std::string master = newm.password();
 
 		try{
-			Manager::generate(get_db_path(), master);
+			Manager::generate(Manager::default_path(), master);
 		}catch(const Manager::ManagerException &e){
 			QMessageBox::critical(NULL, "Error", e.what());
 			return 1;
@@ -58,7 +59,7 @@ int run(QApplication &app){
 		// recurse
 		return run(app);
 	}catch(const Manager::Corrupt&){
-		QMessageBox::critical(NULL, "Error", ("The Passwords database at \"" + get_db_path() + "\" appears to be corrupt.").c_str());
+		QMessageBox::critical(NULL, "Error", ("The Passwords database at \"" + Manager::default_path() + "\" appears to be corrupt.").c_str());
 		return 1;
 	}catch(const Manager::IncorrectPassword&){
 		QMessageBox::critical(NULL, "Error", "Could not unlock the database with that password!");
@@ -75,23 +76,3 @@ int run(QApplication &app){
 
 	return 1;
 }
-
-#ifdef _WIN32
-std::string get_db_path(){
-	char path[MAX_PATH];
-	ExpandEnvironmentStrings("%USERPROFILE%\\Documents\\PasswordsDB", path, MAX_PATH - 1);
-
-	return path;
-}
-#else
-#include <wordexp.h>
-std::string get_db_path(){
-	wordexp_t p;
-
-	wordexp("~/.passwordsdb", &p, 0);
-	const std::string path = p.we_wordv[0];
-	wordfree(&p);
-
-	return path;
-}
-#endif // _WIN32
@@ -1,17 +1,22 @@
 HEADERS += Passwords.h
 HEADERS += Dialog.h
 HEADERS += Manager.h
+HEADERS += agent.h
 HEADERS += crypto.h
+HEADERS += search.h
 
 SOURCES += main.cpp
 SOURCES += Passwords.cpp
 SOURCES += Dialog.cpp
 SOURCES += Manager.cpp
+SOURCES += agent.cpp
 SOURCES += crypto.cpp
+SOURCES += search.cpp
 
 CONFIG += debug console
 
 QMAKE_CXXFLAGS += -std=c++17
 QMAKE_LFLAGS += -lcrypto
+QMAKE_LFLAGS += -lz
 
 QT += widgets
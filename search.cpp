@@ -0,0 +1,452 @@
+#include <cctype>
+#include <algorithm>
+#include <thread>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SEARCH_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SEARCH_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "search.h"
+
+#define PROBE_RATIO 32 // posting list length per already found document above which they're binary searched instead of walked
+#define COMMON_POSTINGS 65536 // documents with a trigram above which it's left out of queries, see rank()
+#define COMPACT_MIN 1024 // removed documents there have to be before the posting lists are compacted
+#define BUILD_RUN 16384 // fewest documents worth a thread of their own in build()
+
+static const std::uint32_t REMOVED = 0xffffffff;
+
+#if defined(SEARCH_AVX2) || defined(SEARCH_SSE2)
+// index of the lowest set bit, <mask> is never 0
+static inline int lowest(unsigned mask){
+#ifdef _MSC_VER
+	unsigned long bit;
+	_BitScanForward(&bit, mask);
+	return bit;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+// byte at a time, for the tail of the haystack and for machines without simd
+static const char *scan(const char *hay, std::string::size_type len, const char *needle, std::string::size_type n){
+	for(std::string::size_type i = 0; i + n <= len; ++i){
+		if(hay[i] == needle[0] && memcmp(hay + i + 1, needle + 1, n - 1) == 0)
+			return hay + i;
+	}
+
+	return NULL;
+}
+
+//
+// search arena
+//
+search::arena::arena()
+	:offsets(1, 0)
+{}
+
+void search::arena::clear(){
+	text.clear();
+	offsets.assign(1, 0);
+}
+
+// reserve room for <count> strings totalling <bytes> characters
+void search::arena::reserve(std::vector<std::string>::size_type count, std::string::size_type bytes){
+	text.reserve(bytes + count);
+	offsets.reserve(count + 1);
+}
+
+void search::arena::push(std::string_view str){
+	for(const char c : str)
+		text.push_back(tolower((unsigned char)c));
+	text.push_back(0);
+
+	offsets.push_back(text.length());
+}
+
+std::vector<std::string>::size_type search::arena::size()const{
+	return offsets.size() - 1;
+}
+
+// does string <i> contain <needle>, which is already folded
+bool search::arena::contains(std::vector<std::string>::size_type i, const std::string &needle)const{
+	const std::string::size_type len = offsets[i + 1] - offsets[i] - 1;
+	if(needle.length() == 0)
+		return true;
+
+	return search::find(text.c_str() + offsets[i], len, needle.c_str(), needle.length()) != NULL;
+}
+
+// every string that contains <needle>, which is already folded, in the order they were pushed
+void search::arena::match(const std::string &needle, std::vector<std::vector<std::string>::size_type> &result)const{
+	result.clear();
+
+	if(needle.length() == 0){
+		result.resize(size());
+		for(std::vector<std::string>::size_type i = 0; i < result.size(); ++i)
+			result[i] = i;
+
+		return;
+	}
+
+	const char *const begin = text.c_str();
+	std::string::size_type pos = 0;
+	std::vector<std::string>::size_type slot = 0;
+	for(;;){
+		const char *hit = search::find(begin + pos, text.length() - pos, needle.c_str(), needle.length());
+		if(hit == NULL)
+			break;
+
+		// the hits only move forward, so does the string they land in
+		const std::string::size_type at = hit - begin;
+		while(offsets[slot + 1] <= at)
+			++slot;
+
+		if(at + needle.length() < offsets[slot + 1]){
+			result.push_back(slot);
+			pos = offsets[slot + 1]; // one hit per string is enough
+		}
+		else
+			pos = at + 1; // ran across the terminator
+	}
+}
+
+std::string search::fold(std::string_view str){
+	std::string folded(str);
+
+	for(char &c : folded)
+		c = tolower((unsigned char)c);
+
+	return folded;
+}
+
+// compares the first and last byte of the needle against a whole register of candidate positions,
+// and only confirms the candidates where both agree
+const char *search::find(const char *hay, std::string::size_type len, const char *needle, std::string::size_type n){
+	if(n == 0)
+		return hay;
+	if(n > len)
+		return NULL;
+
+	std::string::size_type i = 0;
+
+#if defined(SEARCH_AVX2)
+	const __m256i first = _mm256_set1_epi8(needle[0]);
+	const __m256i last = _mm256_set1_epi8(needle[n - 1]);
+	for(; i + n - 1 + 32 <= len; i += 32){
+		const __m256i a = _mm256_loadu_si256((const __m256i*)(hay + i));
+		const __m256i b = _mm256_loadu_si256((const __m256i*)(hay + i + n - 1));
+		unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+		while(mask != 0){
+			const int bit = lowest(mask);
+			if(memcmp(hay + i + bit + 1, needle + 1, n - 1) == 0)
+				return hay + i + bit;
+			mask &= mask - 1;
+		}
+	}
+#elif defined(SEARCH_SSE2)
+	const __m128i first = _mm_set1_epi8(needle[0]);
+	const __m128i last = _mm_set1_epi8(needle[n - 1]);
+	for(; i + n - 1 + 16 <= len; i += 16){
+		const __m128i a = _mm_loadu_si128((const __m128i*)(hay + i));
+		const __m128i b = _mm_loadu_si128((const __m128i*)(hay + i + n - 1));
+		unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+		while(mask != 0){
+			const int bit = lowest(mask);
+			if(memcmp(hay + i + bit + 1, needle + 1, n - 1) == 0)
+				return hay + i + bit;
+			mask &= mask - 1;
+		}
+	}
+#endif
+
+	return scan(hay + i, len - i, needle, n);
+}
+
+//
+// trigram index
+//
+search::trigrams::trigrams()
+	:removed(0)
+{}
+
+void search::trigrams::clear(){
+	postings.clear();
+	documents.clear();
+	owners.clear();
+	sizes.clear();
+	removed = 0;
+	counts.clear();
+}
+
+// trigrams of the folded fields, each field padded with a space on both ends so word edges count, repeats included
+// the three characters are shifted through one integer, nothing is copied
+void search::trigrams::split(const std::vector<std::string_view> &fields, std::vector<std::uint32_t> &grams){
+	grams.clear();
+
+	for(const std::string_view field : fields){
+		if(field.length() == 0)
+			continue;
+
+		std::uint32_t gram = ' ';
+		std::string_view::size_type shifted = 1;
+		for(const char c : field){
+			gram = (gram << 8 | (unsigned char)tolower((unsigned char)c)) & 0xffffff;
+			if(++shifted >= 3)
+				grams.push_back(gram);
+		}
+		grams.push_back((gram << 8 | ' ') & 0xffffff);
+	}
+}
+
+// append <document> to the lists of its trigrams, once each, and return how many distinct ones it has
+// it's newer than every document in <lists>, so a trigram it repeats is the one with it at the end already
+static unsigned short append(std::unordered_map<std::uint32_t, std::vector<std::uint32_t>> &lists, std::uint32_t document, const std::vector<std::uint32_t> &grams){
+	unsigned distinct = 0;
+	for(const std::uint32_t gram : grams){
+		std::vector<std::uint32_t> &list = lists[gram];
+		if(list.empty() || list.back() != document){
+			list.push_back(document);
+			++distinct;
+		}
+	}
+
+	return std::min(distinct, 0xffffu);
+}
+
+// index documents 0 to <count> - 1 from scratch, <fields> gives the fields of one and is called from several threads at once
+// every thread indexes one run of the documents into lists of its own, which are then joined in order
+void search::trigrams::build(std::uint32_t count, const std::function<std::vector<std::string_view>(std::uint32_t)> &fields){
+	clear();
+	documents.resize(count);
+	owners.resize(count);
+	sizes.resize(count);
+	counts.resize(count, 0);
+
+	unsigned threads = std::thread::hardware_concurrency();
+	if(threads == 0)
+		threads = 1;
+	if(threads > count / BUILD_RUN + 1)
+		threads = count / BUILD_RUN + 1;
+
+	std::vector<std::unordered_map<std::uint32_t, std::vector<std::uint32_t>>> runs(threads);
+	const auto work = [&](unsigned run){
+		std::vector<std::uint32_t> grams;
+		for(std::uint32_t document = (unsigned long long)count * run / threads; document < (unsigned long long)count * (run + 1) / threads; ++document){
+			split(fields(document), grams);
+			sizes[document] = append(runs[run], document, grams);
+			documents[document] = document;
+			owners[document] = document;
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for(unsigned i = 1; i < threads; ++i)
+		pool.emplace_back(work, i);
+	work(0);
+	for(std::thread &t : pool)
+		t.join();
+
+	std::unordered_map<std::uint32_t, std::vector<std::uint32_t>::size_type> lengths;
+	for(const auto &run : runs){
+		for(const auto &list : run)
+			lengths[list.first] += list.second.size();
+	}
+
+	postings.reserve(lengths.size());
+	for(const auto &length : lengths)
+		postings[length.first].reserve(length.second);
+	for(auto &run : runs){
+		for(const auto &list : run){
+			std::vector<std::uint32_t> &joined = postings[list.first];
+			joined.insert(joined.end(), list.second.begin(), list.second.end());
+		}
+		run.clear();
+	}
+}
+
+// <id> mustn't be in the index already, remove() it first to change a document
+void search::trigrams::add(std::uint32_t id, const std::vector<std::string_view> &fields){
+	std::vector<std::uint32_t> grams;
+	split(fields, grams);
+
+	const std::uint32_t document = owners.size();
+	sizes.push_back(append(postings, document, grams));
+	if(id >= documents.size())
+		documents.resize(id + 1, REMOVED);
+	documents[id] = document;
+	owners.push_back(id);
+	counts.push_back(0);
+}
+
+// the document stays in the posting lists until there are enough removed ones to be worth a compact()
+void search::trigrams::remove(std::uint32_t id){
+	if(id >= documents.size() || documents[id] == REMOVED)
+		return;
+
+	owners[documents[id]] = REMOVED;
+	documents[id] = REMOVED;
+	++removed;
+
+	if(removed >= COMPACT_MIN && removed > owners.size() - removed)
+		compact();
+}
+
+// give the document under <from> the id <to>, which must not be in use
+void search::trigrams::move(std::uint32_t from, std::uint32_t to){
+	if(from >= documents.size() || documents[from] == REMOVED)
+		return;
+
+	if(to >= documents.size())
+		documents.resize(to + 1, REMOVED);
+	documents[to] = documents[from];
+	owners[documents[to]] = to;
+	documents[from] = REMOVED;
+}
+
+// drop the removed documents and number the rest from 0 again, in the same order so the lists stay ascending
+void search::trigrams::compact(){
+	std::vector<std::uint32_t> renumbered(owners.size(), REMOVED);
+	std::uint32_t next = 0;
+	for(std::vector<std::uint32_t>::size_type document = 0; document < owners.size(); ++document){
+		if(owners[document] == REMOVED)
+			continue;
+
+		renumbered[document] = next;
+		owners[next] = owners[document];
+		sizes[next] = sizes[document];
+		documents[owners[next]] = next;
+		++next;
+	}
+	owners.resize(next);
+	sizes.resize(next);
+	counts.assign(next, 0);
+	removed = 0;
+
+	for(auto it = postings.begin(); it != postings.end();){
+		std::vector<std::uint32_t> &list = it->second;
+		std::vector<std::uint32_t>::size_type kept = 0;
+		for(const std::uint32_t document : list){
+			if(renumbered[document] != REMOVED)
+				list[kept++] = renumbered[document];
+		}
+		list.resize(kept);
+
+		if(list.empty())
+			it = postings.erase(it);
+		else{
+			list.shrink_to_fit();
+			++it;
+		}
+	}
+}
+
+// up to <limit> ids that share at least half of the query's trigrams, best first
+// score is the share of the query found in the document, ties go to the smaller document, then the one added first
+// a trigram in more than COMMON_POSTINGS documents, like the ones of "@gmail.com" in usernames, says little about which
+// documents match and would have every keystroke walk most of the database, so it's left out of the query like a stop word.
+// if that leaves nothing, the rarest of them is the query, as far as its first COMMON_POSTINGS documents
+void search::trigrams::rank(const std::string &query, unsigned limit, std::vector<std::uint32_t> &result)const{
+	result.clear();
+
+	std::vector<std::uint32_t> grams;
+	split(std::vector<std::string_view>(1, query), grams);
+	std::sort(grams.begin(), grams.end());
+	grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+	if(grams.empty())
+		return;
+
+	// shortest lists first, a trigram nobody has is an empty list
+	std::vector<const std::vector<std::uint32_t>*> lists;
+	for(const std::uint32_t gram : grams){
+		const auto it = postings.find(gram);
+		if(it != postings.end())
+			lists.push_back(&it->second);
+	}
+	std::sort(lists.begin(), lists.end(), [](const std::vector<std::uint32_t> *a, const std::vector<std::uint32_t> *b){
+		return a->size() < b->size();
+	});
+
+	std::vector<std::uint32_t>::size_type total = grams.size();
+	std::vector<std::uint32_t>::size_type rare = lists.size();
+	while(rare > 0 && lists[rare - 1]->size() > COMMON_POSTINGS)
+		--rare;
+	if(rare > 0){
+		total -= lists.size() - rare;
+		lists.resize(rare);
+	}
+	else if(!lists.empty()){
+		total = 1;
+		lists.resize(1);
+	}
+
+	const unsigned needed = (total + 1) / 2;
+
+	// a document with <needed> of the query's trigrams has at least one of the (total - needed + 1) rarest ones,
+	// so only those lists can add documents, the common ones only add to the count of documents already found
+	const std::vector<std::uint32_t>::size_type missing = total - lists.size();
+	const std::vector<std::uint32_t>::size_type walked = std::min(lists.size(), total - needed + 1 > missing ? total - needed + 1 - missing : 0);
+
+	std::vector<std::uint32_t> touched;
+	for(std::vector<std::uint32_t>::size_type i = 0; i < walked; ++i){
+		const std::vector<std::uint32_t> &list = *lists[i];
+		const auto end = list.size() > COMMON_POSTINGS ? list.begin() + COMMON_POSTINGS : list.end();
+		for(auto it = list.begin(); it != end; ++it){
+			if(counts[*it]++ == 0)
+				touched.push_back(*it);
+		}
+	}
+
+	for(std::vector<std::uint32_t>::size_type i = walked; i < lists.size(); ++i){
+		if(lists[i]->size() / PROBE_RATIO < touched.size()){
+			// sequential pass over the list beats a binary search per document
+			for(const std::uint32_t document : *lists[i]){
+				if(counts[document] != 0)
+					++counts[document];
+			}
+		}
+		else{
+			for(const std::uint32_t document : touched){
+				if(std::binary_search(lists[i]->begin(), lists[i]->end(), document))
+					++counts[document];
+			}
+		}
+	}
+
+	std::vector<std::uint32_t> candidates;
+	for(const std::uint32_t document : touched){
+		if(counts[document] >= needed && owners[document] != REMOVED)
+			candidates.push_back(document);
+	}
+
+	const auto better = [this](std::uint32_t a, std::uint32_t b){
+		if(counts[a] != counts[b])
+			return counts[a] > counts[b];
+		if(sizes[a] != sizes[b])
+			return sizes[a] < sizes[b];
+		return a < b;
+	};
+
+	if(candidates.size() > limit){
+		std::partial_sort(candidates.begin(), candidates.begin() + limit, candidates.end(), better);
+		candidates.resize(limit);
+	}
+	else
+		std::sort(candidates.begin(), candidates.end(), better);
+
+	for(const std::uint32_t document : touched)
+		counts[document] = 0;
+
+	result.reserve(candidates.size());
+	for(const std::uint32_t document : candidates)
+		result.push_back(owners[document]);
+}
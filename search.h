@@ -0,0 +1,64 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <functional>
+#include <cstdint>
+
+namespace search{
+	// case-folded copies of many short strings, stored back to back in one buffer
+	// so a search is a single linear scan instead of one allocation and find() per string
+	class arena{
+	public:
+		arena();
+
+		void clear();
+		void reserve(std::vector<std::string>::size_type, std::string::size_type);
+		void push(std::string_view);
+		std::vector<std::string>::size_type size()const;
+
+		bool contains(std::vector<std::string>::size_type, const std::string&)const;
+		void match(const std::string&, std::vector<std::vector<std::string>::size_type>&)const;
+
+	private:
+		std::string text; // every string, folded and terminated with '\0'
+		std::vector<std::string::size_type> offsets; // start of every string in <text>, plus the end of the buffer
+	};
+
+	// inverted index from every three character sequence to the documents that contain it
+	// a document is a handful of short strings (fields) under one id. ids are the caller's and can be reused, inside the
+	// index every document gets the next number, so the lists stay ascending by only ever being appended to
+	class trigrams{
+	public:
+		trigrams();
+
+		void clear();
+		void build(std::uint32_t, const std::function<std::vector<std::string_view>(std::uint32_t)>&);
+		void add(std::uint32_t, const std::vector<std::string_view>&);
+		void remove(std::uint32_t);
+		void move(std::uint32_t, std::uint32_t);
+		void rank(const std::string&, unsigned, std::vector<std::uint32_t>&)const;
+
+	private:
+		static void split(const std::vector<std::string_view>&, std::vector<std::uint32_t>&);
+		void compact();
+
+		std::unordered_map<std::uint32_t, std::vector<std::uint32_t>> postings; // trigram -> documents, ascending, removed ones included
+		std::vector<std::uint32_t> documents; // id -> its document
+		std::vector<std::uint32_t> owners; // document -> its id, or REMOVED
+		std::vector<unsigned short> sizes; // distinct trigrams in each document
+		std::uint32_t removed; // documents still in the lists that have been removed, dropped by compact()
+		mutable std::vector<unsigned short> counts; // scratch space for rank(), by document, all zeros between calls
+	};
+
+	// case-fold a string the same way the arena does
+	std::string fold(std::string_view);
+
+	// position of the first occurrence of a needle in a haystack, or NULL
+	const char *find(const char*, std::string::size_type, const char*, std::string::size_type);
+}
+
+#endif // SEARCH_H
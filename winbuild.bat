@@ -1 +1,2 @@
-cl /I"C:\OpenSSL-Win32\include" /I"C:\Qt\5.9.1\msvc2017_64\include" /I"C:\Qt\5.9.1\msvc2017_64\include\QtCore" /I"C:\Qt\5.9.1\msvc2017_64\include\QtGui" /I"C:\Qt\5.9.1\msvc2017_64\include\QtWidgets" /EHsc /std:c++17 *.cpp libeay32.lib C:\Qt\5.9.1\msvc2017_64\lib\Qt5Core.lib C:\Qt\5.9.1\msvc2017_64\lib\Qt5Widgets.lib C:\Qt\5.9.1\msvc2017_64\lib\Qt5Gui.lib /link /out:Passwords.exe
+cl /I"C:\OpenSSL-Win32\include" /I"C:\zlib\include" /I"C:\Qt\5.9.1\msvc2017_64\include" /I"C:\Qt\5.9.1\msvc2017_64\include\QtCore" /I"C:\Qt\5.9.1\msvc2017_64\include\QtGui" /I"C:\Qt\5.9.1\msvc2017_64\include\QtWidgets" /EHsc /std:c++17 main.cpp Passwords.cpp Dialog.cpp Manager.cpp agent.cpp crypto.cpp search.cpp libeay32.lib C:\zlib\lib\zlib.lib C:\Qt\5.9.1\msvc2017_64\lib\Qt5Core.lib C:\Qt\5.9.1\msvc2017_64\lib\Qt5Widgets.lib C:\Qt\5.9.1\msvc2017_64\lib\Qt5Gui.lib /link /out:Passwords.exe
+cl /I"C:\OpenSSL-Win32\include" /I"C:\zlib\include" /I"C:\Qt\5.9.1\msvc2017_64\include" /I"C:\Qt\5.9.1\msvc2017_64\include\QtCore" /EHsc /std:c++17 cli.cpp Manager.cpp agent.cpp crypto.cpp search.cpp libeay32.lib C:\zlib\lib\zlib.lib C:\Qt\5.9.1\msvc2017_64\lib\Qt5Core.lib /link /out:passwords-cli.exe